@@ -0,0 +1,208 @@
+#include "backtrace_resolver.h"
+
+#include "demangle.h"
+
+#include <backtrace.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+
+namespace
+{
+struct pc_frame
+{
+  const char* file;
+  int line;
+  const char* function;
+};
+
+// Frames reported by backtrace_pcinfo(), reused by every lookup made on the same thread.
+thread_local std::vector<pc_frame> t_frames;
+
+struct symbol_info
+{
+  const char* name = nullptr;
+  uintptr_t value = 0;
+};
+
+void ignore_error(void*, const char*, int)
+{
+}
+
+void keep_error(void* data, const char* msg, int errnum)
+{
+  // -1 only means that there is no debug information, which is not an error for symbols.
+  std::string* error = static_cast<std::string*>(data);
+  if(errnum > 0 && error->empty())
+    *error = std::string(msg) + ": " + strerror(errnum);
+}
+
+void add_symbol(void* data, uintptr_t, const char* name, uintptr_t value, uintptr_t)
+{
+  symbol_info* info = static_cast<symbol_info*>(data);
+  info->name = name;
+  info->value = value;
+}
+
+int add_frame(void* data, uintptr_t, const char* file, int line, const char* function)
+{
+  static_cast<std::vector<pc_frame>*>(data)->push_back({ file, line, function });
+  return 0;
+}
+
+// Where libbacktrace puts the file. It takes the file for the main program of the calling process, and
+// a position independent one is placed at the load address of that program.
+uintptr_t libbacktrace_base(const std::string& fname)
+{
+  Elf64_Ehdr ehdr;
+  const int fd = open(fname.c_str(), O_RDONLY | O_CLOEXEC);
+  const bool read_all = fd >= 0 && pread(fd, &ehdr, sizeof(ehdr), 0) == ssize_t(sizeof(ehdr));
+  if(fd >= 0)
+    close(fd);
+  if(!read_all || memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0 || ehdr.e_type != ET_DYN)
+    return 0;
+
+  uintptr_t base = 0;
+  dl_iterate_phdr([](dl_phdr_info* info, size_t, void* data) {
+    *static_cast<uintptr_t*>(data) = info->dlpi_addr;
+    return 1; // the main program comes first
+  }, &base);
+  return base;
+}
+}
+
+backtrace_resolver::backtrace_resolver(const std::string& fname, const resolver_options& opts)
+  : m_opts(opts)
+  , m_fname(fname)
+  , m_base(libbacktrace_base(fname))
+{
+  std::string error;
+  m_state = backtrace_create_state(m_fname.c_str(), 1, keep_error, &error);
+  if(!m_state)
+    throw std::runtime_error(fname + ": " + error);
+
+  // libbacktrace opens the file on first use; do it now so that a bad file fails here.
+  backtrace_syminfo(m_state, 0, [](void*, uintptr_t, const char*, uintptr_t, uintptr_t) {}, keep_error, &error);
+  if(!error.empty())
+    throw std::runtime_error(fname + ": " + error);
+}
+
+int backtrace_resolver::resolve(uintptr_t addr, resolved_frame& frame, resolve_level level)
+{
+  frame = {};
+  frame.address = addr;
+  const uintptr_t pc = addr + m_base;
+
+  if(m_opts.show_symbols)
+  {
+    symbol_info info;
+    backtrace_syminfo(m_state, pc, add_symbol, ignore_error, &info);
+    if(info.name)
+    {
+      frame.name = symname(info.name);
+      frame.offset = pc - info.value;
+    }
+  }
+
+  if(level < resolve_level::lines)
+    return frame.status = frame.name.empty() ? 1 : 0;
+
+  // Innermost first: the inlined subroutines, then the function they are in.
+  std::vector<pc_frame>& frames = t_frames;
+  frames.clear();
+  backtrace_pcinfo(m_state, pc, add_frame, ignore_error, &frames);
+  if(frames.empty())
+    return frame.status = frame.name.empty() ? 1 : 0;
+
+  auto file_name = [this](const char* file) -> std::string_view {
+    return !file ? "" : m_opts.only_basenames ? basename(file) : file;
+  };
+
+  frame.file = file_name(frames[0].file);
+  frame.line = frames[0].line;
+
+  if(level < resolve_level::inlines || !(m_opts.show_functions || m_opts.show_inlines))
+    return frame.status = frame.name.empty() && frame.file.empty() ? 1 : 0;
+
+  frame.inline_depth = frames.size() - 1;
+  if(frame.name.empty() && m_opts.show_functions && frames.back().function)
+    frame.name = symname(frames.back().function);
+
+  if(m_opts.show_inlines && frames.size() > 1)
+  {
+    // Each subroutine was called from where the next frame is.
+    std::vector<inline_frame> chain;
+    chain.reserve(frames.size() - 1);
+    for(size_t k = 0; k + 1 < frames.size(); ++k)
+    {
+      inline_frame f;
+      f.function = frames[k].function ? symname(frames[k].function) : std::string_view();
+      f.call_file = file_name(frames[k + 1].file);
+      f.call_line = frames[k + 1].line;
+      chain.push_back(f);
+    }
+    frame.inlines = keep_chain(chain);
+  }
+
+  return frame.status = frame.name.empty() && frame.file.empty() ? 1 : 0;
+}
+
+size_t backtrace_resolver::resolve_batch(std::span<const uintptr_t> addrs, std::span<resolved_frame> results,
+                                         resolve_level level)
+{
+  size_t failed = 0;
+  for(size_t i = 0; i < addrs.size(); ++i)
+    if(resolve(addrs[i], results[i], level) != 0)
+      ++failed;
+  return failed;
+}
+
+std::string_view backtrace_resolver::symname(const char* name)
+{
+  if(!m_opts.demangle)
+    return name;
+
+  {
+    std::shared_lock<std::shared_mutex> guard(m_demangled_lock);
+    auto it = m_demangled.find(name);
+    if(it != m_demangled.end())
+      return it->second;
+  }
+
+  std::string_view demangled = demangle(name, m_names);
+  std::unique_lock<std::shared_mutex> guard(m_demangled_lock);
+  return m_demangled.emplace(name, demangled).first->second;
+}
+
+std::span<const inline_frame> backtrace_resolver::keep_chain(std::vector<inline_frame>& chain)
+{
+  std::lock_guard<std::mutex> guard(m_chains_lock);
+  return *m_chains.insert(std::move(chain)).first;
+}
+
+size_t backtrace_resolver::chain_hash::operator()(const std::vector<inline_frame>& chain) const
+{
+  size_t h = chain.size();
+  for(const inline_frame& f : chain)
+  {
+    h = h * 31 + std::hash<std::string_view>()(f.function);
+    h = h * 31 + std::hash<std::string_view>()(f.call_file);
+    h = h * 31 + f.call_line;
+  }
+  return h;
+}
+
+bool backtrace_resolver::chain_equal::operator()(const std::vector<inline_frame>& a,
+                                                 const std::vector<inline_frame>& b) const
+{
+  return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](const inline_frame& x, const inline_frame& y) {
+    return x.function == y.function && x.call_file == y.call_file && x.call_line == y.call_line &&
+           x.call_column == y.call_column;
+  });
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "resolver_backend.h"
+#include "string_pool.h"
+
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+struct backtrace_state;
+
+// Resolves addresses of one ELF file with libbacktrace, as the second backend next to elfutils.
+// Symbols come from backtrace_syminfo(), lines and inlines from backtrace_pcinfo(). libbacktrace
+// knows neither sections nor columns, so those fields stay empty, and file names are the ones it
+// builds from the line program; only_basenames is the only file option honoured.
+//
+// Besides the file, libbacktrace also reads the shared objects mapped into the calling process, at
+// their runtime addresses. They are far above the link-time addresses of the file, which is what is
+// looked up here.
+//
+// libbacktrace states are never freed, so a backtrace_resolver leaks its DWARF tables when destroyed:
+// create one per file and keep it. Lookups may be called concurrently from any number of threads.
+class backtrace_resolver final : public resolver_backend
+{
+public:
+  // Throws std::runtime_error if the file cannot be read.
+  backtrace_resolver(const std::string& fname, const resolver_options& opts);
+  backtrace_resolver(const backtrace_resolver&) = delete;
+  backtrace_resolver& operator=(const backtrace_resolver&) = delete;
+
+  const char* name() const override { return "libbacktrace"; }
+
+  int resolve(uintptr_t addr, resolved_frame& frame, resolve_level level) override;
+  size_t resolve_batch(std::span<const uintptr_t> addrs, std::span<resolved_frame> results,
+                       resolve_level level) override;
+
+private:
+  std::string_view symname(const char* name);
+  std::span<const inline_frame> keep_chain(std::vector<inline_frame>& chain);
+
+  struct chain_hash
+  {
+    size_t operator()(const std::vector<inline_frame>& chain) const;
+  };
+  struct chain_equal
+  {
+    bool operator()(const std::vector<inline_frame>& a, const std::vector<inline_frame>& b) const;
+  };
+
+  const resolver_options m_opts;
+  const std::string m_fname; // libbacktrace keeps the pointer
+  const uintptr_t m_base;    // added by libbacktrace to the addresses of the file
+  backtrace_state* m_state = nullptr;
+  string_pool m_names;
+
+  // Demangled names by the libbacktrace string they come from, which is never freed.
+  std::shared_mutex m_demangled_lock;
+  std::unordered_map<const char*, std::string_view> m_demangled;
+
+  // Inline chains handed out with show_inlines, so that frames can point to them. Kept once per
+  // distinct chain rather than per address, which bounds them by the inlining in the file, however
+  // many addresses are looked up; nodes never move, so the spans stay valid.
+  std::mutex m_chains_lock;
+  std::unordered_set<std::vector<inline_frame>, chain_hash, chain_equal> m_chains;
+};
@@ -0,0 +1,271 @@
+// Benchmark symbol_resolver on one or more files and print the results as JSON, one object per line:
+//
+//   bench_resolver [-l symbols|lines|inlines]... [-i] [-S] [-t] [-w threads] [-n count] [-r passes]
+//                  [-B batch] [-s seed] [-a addresses] file...
+//
+// Every file is benchmarked at every level given (all three by default), each run with a resolver of
+// its own. Addresses are read from the addresses file, one hex address per line, or drawn at random
+// from the functions in the symbol table of the file.
+//
+// Fields of a result:
+//   cold_ms              construction and first lookup
+//   first_pass_per_s     one resolve() per address on a new resolver, the cost of filling the caches;
+//                        with -w it runs while the prewarm threads fill them
+//   prewarm_ms           with -w, construction until the prewarm is done, waited for after the first pass
+//   warm_per_s           resolve() per address over the following passes
+//   batch_per_s          resolve_batch() in batches of the given size over the same passes
+//   p50_ns ... max_ns    latency of the warm resolve() calls
+//   rss_kib              resident set added by the run, while the resolver is alive
+//   peak_rss_kib         highest resident set reached by the run over where it started
+//   failed               addresses that did not resolve
+//   stages               with -t, the resolver's stats() per stage at the end of the run
+
+#include "bench_util.h"
+#include "symbol_resolver.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+using bench::seconds;
+using bench::steady;
+
+const char* level_name(resolve_level level)
+{
+  switch(level)
+  {
+  case resolve_level::symbols:
+    return "symbols";
+  case resolve_level::lines:
+    return "lines";
+  case resolve_level::inlines:
+    return "inlines";
+  }
+  return "?";
+}
+
+std::string json_string(const std::string& s)
+{
+  std::string out = "\"";
+  for(char c : s)
+  {
+    if(c == '"' || c == '\\')
+      out += '\\';
+    if(static_cast<unsigned char>(c) < 0x20)
+    {
+      char esc[8];
+      snprintf(esc, sizeof(esc), "\\u%04x", c);
+      out += esc;
+    }
+    else
+      out += c;
+  }
+  return out + '"';
+}
+
+struct settings
+{
+  resolver_options opts;
+  size_t count = 100000;
+  size_t passes = 3;
+  size_t batch = 256;
+  unsigned seed = 1;
+  const char* addresses = nullptr;
+  bool stages = false;
+};
+
+// ,"stages":{...} with the counters of the stages that ran.
+std::string stages_json(const resolver_stats& stats)
+{
+  std::string out = ",\"stages\":{";
+  bool first = true;
+  for(size_t i = 0; i < resolver_stage_count; ++i)
+  {
+    const stage_stats& st = stats.stages[i];
+    if(st.calls == 0)
+      continue;
+
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s\"%s\":{\"calls\":%llu,\"misses\":%llu,\"timed\":%llu,\"mean_ns\":%.0f,"
+             "\"p50_ns\":%llu,\"p99_ns\":%llu}",
+             first ? "" : ",", stage_name(resolver_stage(i)), (unsigned long long)st.calls,
+             (unsigned long long)st.misses, (unsigned long long)st.timed, st.mean_ns(),
+             (unsigned long long)st.percentile(0.5), (unsigned long long)st.percentile(0.99));
+    out += buf;
+    first = false;
+  }
+  return out + '}';
+}
+
+void run(const std::string& file, const std::vector<uintptr_t>& addrs, resolve_level level,
+         const settings& s)
+{
+  const long rss_before = bench::rss_kib();
+  bench::reset_peak_rss();
+
+  const steady::time_point created = steady::now();
+  steady::time_point t0 = created;
+  auto resolver = std::make_unique<symbol_resolver>(file, s.opts);
+  resolved_frame frame;
+  resolver->resolve(addrs[0], frame, level);
+  const double cold = seconds(steady::now() - t0);
+
+  size_t failed = 0;
+  t0 = steady::now();
+  for(uintptr_t addr : addrs)
+    if(resolver->resolve(addr, frame, level) != 0)
+      ++failed;
+  const double first_pass = addrs.size() / seconds(steady::now() - t0);
+
+  std::string prewarm;
+  if(s.opts.prewarm_threads)
+  {
+    resolver->wait_prewarm();
+    char buf[64];
+    snprintf(buf, sizeof(buf), ",\"prewarm_threads\":%u,\"prewarm_ms\":%.3f", s.opts.prewarm_threads,
+             seconds(steady::now() - created) * 1000);
+    prewarm = buf;
+  }
+
+  std::vector<uint64_t> latency;
+  latency.reserve(addrs.size() * s.passes);
+  t0 = steady::now();
+  for(size_t pass = 0; pass < s.passes; ++pass)
+    for(uintptr_t addr : addrs)
+    {
+      const steady::time_point start = steady::now();
+      resolver->resolve(addr, frame, level);
+      latency.push_back(std::chrono::nanoseconds(steady::now() - start).count());
+    }
+  const double warm = addrs.size() * s.passes / seconds(steady::now() - t0);
+  std::sort(latency.begin(), latency.end());
+
+  std::vector<resolved_frame> results(s.batch);
+  t0 = steady::now();
+  for(size_t pass = 0; pass < s.passes; ++pass)
+    for(size_t lo = 0; lo < addrs.size(); lo += s.batch)
+    {
+      const size_t n = std::min(s.batch, addrs.size() - lo);
+      resolver->resolve_batch(std::span<const uintptr_t>(addrs).subspan(lo, n),
+                              std::span<resolved_frame>(results).first(n), level);
+    }
+  const double batch = addrs.size() * s.passes / seconds(steady::now() - t0);
+
+  const long rss = bench::rss_kib() - rss_before;
+  const long peak = bench::peak_rss_kib() - rss_before;
+  const std::string stages = s.stages ? stages_json(resolver->stats()) : std::string();
+
+  printf("{\"file\":%s,\"level\":\"%s\",\"symbols_only\":%s,\"addresses\":%zu,\"passes\":%zu,\"batch\":%zu,"
+         "\"cold_ms\":%.3f,\"first_pass_per_s\":%.0f,\"warm_per_s\":%.0f,\"batch_per_s\":%.0f,"
+         "\"p50_ns\":%llu,\"p90_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu,"
+         "\"rss_kib\":%ld,\"peak_rss_kib\":%ld,\"failed\":%zu%s%s}\n",
+         json_string(file).c_str(), level_name(level), s.opts.symbols_only ? "true" : "false", addrs.size(),
+         s.passes, s.batch, cold * 1000, first_pass, warm, batch,
+         (unsigned long long)bench::percentile(latency, 0.5), (unsigned long long)bench::percentile(latency, 0.9),
+         (unsigned long long)bench::percentile(latency, 0.99), (unsigned long long)bench::percentile(latency, 0.999),
+         (unsigned long long)latency.back(), rss, peak, failed, prewarm.c_str(), stages.c_str());
+  fflush(stdout);
+}
+
+void usage(const char* argv0)
+{
+  fprintf(stderr,
+          "usage: %s [-l symbols|lines|inlines]... [-i] [-S] [-t] [-w threads] [-n count] [-r passes] [-B batch] [-s seed] "
+          "[-a addresses] file...\n",
+          argv0);
+}
+}
+
+int main(int argc, char* argv[])
+{
+  settings s;
+  std::vector<resolve_level> levels;
+
+  int opt;
+  while((opt = getopt(argc, argv, "l:iStw:n:r:B:s:a:")) != -1)
+  {
+    switch(opt)
+    {
+    case 'l':
+      if(strcmp(optarg, "symbols") == 0)
+        levels.push_back(resolve_level::symbols);
+      else if(strcmp(optarg, "lines") == 0)
+        levels.push_back(resolve_level::lines);
+      else if(strcmp(optarg, "inlines") == 0)
+        levels.push_back(resolve_level::inlines);
+      else
+      {
+        fprintf(stderr, "unknown level '%s'\n", optarg);
+        return 2;
+      }
+      break;
+    case 'i':
+      s.opts.show_inlines = true;
+      break;
+    case 'S':
+      s.opts.symbols_only = true;
+      break;
+    case 't':
+      s.stages = true;
+      break;
+    case 'w':
+      s.opts.prewarm_threads = std::stoul(optarg);
+      break;
+    case 'n':
+      s.count = std::stoul(optarg);
+      break;
+    case 'r':
+      s.passes = std::stoul(optarg);
+      break;
+    case 'B':
+      s.batch = std::stoul(optarg);
+      break;
+    case 's':
+      s.seed = std::stoul(optarg);
+      break;
+    case 'a':
+      s.addresses = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if(optind >= argc || s.count == 0 || s.passes == 0 || s.batch == 0)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+  if(levels.empty())
+    levels = { resolve_level::symbols, resolve_level::lines, resolve_level::inlines };
+
+  try
+  {
+    for(int i = optind; i < argc; ++i)
+    {
+      const std::string file = argv[i];
+      const std::vector<uintptr_t> addrs =
+        s.addresses ? bench::read_addresses(s.addresses) : bench::random_addresses(file, s.count, s.seed);
+      if(addrs.empty())
+        throw std::runtime_error("no addresses");
+
+      for(resolve_level level : levels)
+        run(file, addrs, level, s);
+    }
+  }
+  catch(const std::exception& e)
+  {
+    fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+// Helpers shared by the benchmark programs: timing, memory and the addresses to resolve.
+
+#include "elf_image.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace bench
+{
+using steady = std::chrono::steady_clock;
+
+inline double seconds(steady::duration d)
+{
+  return std::chrono::duration<double>(d).count();
+}
+
+// Current resident set, KiB.
+inline long rss_kib()
+{
+  std::ifstream statm("/proc/self/statm");
+  long size = 0, resident = 0;
+  statm >> size >> resident;
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Highest resident set since the process started or since the last reset_peak_rss(), KiB.
+inline long peak_rss_kib()
+{
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while(std::getline(status, line))
+    if(line.compare(0, 6, "VmHWM:") == 0)
+      return std::stol(line.substr(6));
+  return 0;
+}
+
+// Start a new peak from the current resident set. Returns false where the kernel does not support it,
+// and peak_rss_kib() keeps covering the whole process.
+inline bool reset_peak_rss()
+{
+  FILE* f = fopen("/proc/self/clear_refs", "w");
+  if(!f)
+    return false;
+  const bool ok = fputs("5", f) >= 0;
+  return fclose(f) == 0 && ok;
+}
+
+// Element at fraction q of sorted, which must not be empty.
+inline uint64_t percentile(const std::vector<uint64_t>& sorted, double q)
+{
+  return sorted[std::min(sorted.size() - 1, size_t(sorted.size() * q))];
+}
+
+// Hex addresses, one per line.
+inline std::vector<uintptr_t> read_addresses(const char* path)
+{
+  std::ifstream in(path);
+  if(!in)
+    throw std::runtime_error(std::string(path) + ": " + strerror(errno));
+
+  std::vector<uintptr_t> addrs;
+  std::string line;
+  while(std::getline(in, line))
+    if(!line.empty())
+      addrs.push_back(std::stoull(line, nullptr, 16));
+  return addrs;
+}
+
+// count pcs inside the sized functions of file, every function equally likely.
+inline std::vector<uintptr_t> random_addresses(const std::string& file, size_t count, unsigned seed)
+{
+  elf_image elf(file);
+  if(!elf)
+    throw std::runtime_error(file + ": cannot read the symbol table in place, give an address file");
+
+  std::vector<elf_image::symbol> functions;
+  for(size_t i = 1; i < elf.symbol_count(); ++i)
+  {
+    const elf_image::symbol sym = elf.get_symbol(i);
+    if((sym.info & 0xf) == STT_FUNC && sym.size > 0 && sym.shndx != SHN_UNDEF)
+      functions.push_back(sym);
+  }
+  if(functions.empty())
+    throw std::runtime_error(file + ": no functions in the symbol table");
+
+  std::mt19937_64 rng(seed);
+  std::vector<uintptr_t> addrs(count);
+  for(uintptr_t& addr : addrs)
+  {
+    const elf_image::symbol& f = functions[rng() % functions.size()];
+    addr = f.value + rng() % f.size;
+  }
+  return addrs;
+}
+}
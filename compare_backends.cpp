@@ -0,0 +1,214 @@
+// Run the elfutils and libbacktrace backends over the same addresses and compare speed, memory and
+// results.
+//
+//   compare_backends [-l symbols|lines|inlines] [-i] [-n count] [-r passes] [-B batch] [-s seed] file [addresses]
+//
+// Addresses are read from the addresses file, one hex address per line, or drawn at random from the
+// functions in the symbol table of file.
+
+#include "bench_util.h"
+#include "resolver_backend.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+using bench::seconds;
+using bench::steady;
+
+struct run
+{
+  std::unique_ptr<resolver_backend> backend;
+  double cold = 0;   // construction and first lookup, seconds
+  double single = 0; // lookups per second, one resolve() per address
+  double batch = 0;  // lookups per second through resolve_batch()
+  uint64_t p50 = 0, p90 = 0, p99 = 0, max = 0; // resolve() latency, ns
+  long rss = 0;      // KiB added to the resident set
+  std::vector<resolved_frame> frames;
+};
+
+run measure(backend_kind kind, const std::string& file, const resolver_options& opts,
+            const std::vector<uintptr_t>& addrs, resolve_level level, size_t passes, size_t batch)
+{
+  run r;
+  const long rss_before = bench::rss_kib();
+
+  steady::time_point t0 = steady::now();
+  r.backend = make_backend(kind, file, opts);
+  resolved_frame first;
+  r.backend->resolve(addrs[0], first, level);
+  r.cold = seconds(steady::now() - t0);
+
+  r.frames.resize(addrs.size());
+  std::vector<uint64_t> latency;
+  latency.reserve(addrs.size() * passes);
+  t0 = steady::now();
+  for(size_t pass = 0; pass < passes; ++pass)
+    for(size_t i = 0; i < addrs.size(); ++i)
+    {
+      const steady::time_point start = steady::now();
+      r.backend->resolve(addrs[i], r.frames[i], level);
+      latency.push_back(std::chrono::nanoseconds(steady::now() - start).count());
+    }
+  r.single = addrs.size() * passes / seconds(steady::now() - t0);
+
+  std::sort(latency.begin(), latency.end());
+  r.p50 = bench::percentile(latency, 0.5);
+  r.p90 = bench::percentile(latency, 0.9);
+  r.p99 = bench::percentile(latency, 0.99);
+  r.max = latency.back();
+
+  std::vector<resolved_frame> results(batch);
+  t0 = steady::now();
+  for(size_t pass = 0; pass < passes; ++pass)
+    for(size_t lo = 0; lo < addrs.size(); lo += batch)
+    {
+      const size_t n = std::min(batch, addrs.size() - lo);
+      r.backend->resolve_batch(std::span<const uintptr_t>(addrs).subspan(lo, n),
+                               std::span<resolved_frame>(results).first(n), level);
+    }
+  r.batch = addrs.size() * passes / seconds(steady::now() - t0);
+
+  r.rss = bench::rss_kib() - rss_before;
+  return r;
+}
+
+// Addresses where the two backends disagree, by field.
+void compare(const run& a, const run& b, const std::vector<uintptr_t>& addrs, resolve_level level)
+{
+  const char* fields[] = { "name", "offset", "file", "line", "inline_depth" };
+  size_t counts[5] = {};
+  size_t differing = 0, shown = 0;
+
+  for(size_t i = 0; i < addrs.size(); ++i)
+  {
+    const resolved_frame& x = a.frames[i];
+    const resolved_frame& y = b.frames[i];
+    const bool diff[5] = {
+      x.name != y.name,
+      x.offset != y.offset,
+      level >= resolve_level::lines && x.file != y.file,
+      level >= resolve_level::lines && x.line != y.line,
+      level >= resolve_level::inlines && x.inline_depth != y.inline_depth,
+    };
+
+    bool any = false;
+    for(int f = 0; f < 5; ++f)
+      if(diff[f])
+      {
+        ++counts[f];
+        any = true;
+      }
+    if(!any)
+      continue;
+
+    ++differing;
+    if(shown++ < 10)
+      printf("  %#zx\n    %-12s %.*s+%#zx %.*s:%u depth %u\n    %-12s %.*s+%#zx %.*s:%u depth %u\n", size_t(addrs[i]),
+             a.backend->name(), int(x.name.size()), x.name.data(), size_t(x.offset), int(x.file.size()),
+             x.file.data(), x.line, x.inline_depth, b.backend->name(), int(y.name.size()), y.name.data(),
+             size_t(y.offset), int(y.file.size()), y.file.data(), y.line, y.inline_depth);
+  }
+
+  printf("mismatches: %zu of %zu addresses", differing, addrs.size());
+  for(int f = 0; f < 5; ++f)
+    if(counts[f])
+      printf(", %s %zu", fields[f], counts[f]);
+  printf("\n");
+}
+}
+
+int main(int argc, char* argv[])
+{
+  resolve_level level = resolve_level::lines;
+  resolver_options opts;
+  size_t count = 100000, passes = 3, batch = 256;
+  unsigned seed = 1;
+
+  int opt;
+  while((opt = getopt(argc, argv, "l:in:r:B:s:")) != -1)
+  {
+    switch(opt)
+    {
+    case 'l':
+      if(strcmp(optarg, "symbols") == 0)
+        level = resolve_level::symbols;
+      else if(strcmp(optarg, "lines") == 0)
+        level = resolve_level::lines;
+      else if(strcmp(optarg, "inlines") == 0)
+        level = resolve_level::inlines;
+      else
+      {
+        fprintf(stderr, "unknown level '%s'\n", optarg);
+        return 2;
+      }
+      break;
+    case 'i':
+      opts.show_inlines = true;
+      break;
+    case 'n':
+      count = std::stoul(optarg);
+      break;
+    case 'r':
+      passes = std::stoul(optarg);
+      break;
+    case 'B':
+      batch = std::stoul(optarg);
+      break;
+    case 's':
+      seed = std::stoul(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-l symbols|lines|inlines] [-i] [-n count] [-r passes] [-B batch] [-s seed] file [addresses]\n",
+              argv[0]);
+      return 2;
+    }
+  }
+  if(optind >= argc || count == 0 || passes == 0 || batch == 0)
+  {
+    fprintf(stderr, "usage: %s [-l symbols|lines|inlines] [-i] [-n count] [-r passes] [-B batch] [-s seed] file [addresses]\n",
+            argv[0]);
+    return 2;
+  }
+
+  try
+  {
+    const std::string file = argv[optind];
+    const std::vector<uintptr_t> addrs =
+      optind + 1 < argc ? bench::read_addresses(argv[optind + 1]) : bench::random_addresses(file, count, seed);
+    if(addrs.empty())
+      throw std::runtime_error("no addresses");
+
+    // The backends run one after the other in this process; the second finds the file in the page
+    // cache, so compare cold times over several runs with the order swapped.
+    run runs[] = {
+      measure(backend_kind::elfutils, file, opts, addrs, level, passes, batch),
+      measure(backend_kind::libbacktrace, file, opts, addrs, level, passes, batch),
+    };
+
+    printf("%zu addresses, %zu passes, batches of %zu\n", addrs.size(), passes, batch);
+    printf("%-12s %10s %12s %12s %8s %8s %8s %10s %10s\n", "backend", "cold ms", "lookups/s", "batch/s", "p50 ns",
+           "p90 ns", "p99 ns", "max ns", "rss KiB");
+    for(const run& r : runs)
+      printf("%-12s %10.2f %12.0f %12.0f %8llu %8llu %8llu %10llu %10ld\n", r.backend->name(), r.cold * 1000,
+             r.single, r.batch, (unsigned long long)r.p50, (unsigned long long)r.p90, (unsigned long long)r.p99,
+             (unsigned long long)r.max, r.rss);
+
+    compare(runs[0], runs[1], addrs, level);
+  }
+  catch(const std::exception& e)
+  {
+    fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
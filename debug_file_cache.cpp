@@ -0,0 +1,188 @@
+#include "debug_file_cache.h"
+
+#include <fcntl.h>
+#include <gelf.h>
+#include <libelf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+bool has_compressed_section(Elf* elf)
+{
+  for(Elf_Scn* scn = nullptr; (scn = elf_nextscn(elf, scn)) != nullptr;)
+  {
+    GElf_Shdr shdr;
+    if(gelf_getshdr(scn, &shdr) && (shdr.sh_flags & SHF_COMPRESSED))
+      return true;
+  }
+  return false;
+}
+
+// Write elf to out with its SHF_COMPRESSED sections decompressed. Sections keep their order, so
+// indices and links stay valid; libelf lays the file out anew. Program headers are copied as they
+// are, libdwfl only takes addresses from those of a debug file.
+bool write_decompressed(Elf* elf, int out)
+{
+  GElf_Ehdr ehdr;
+  size_t phnum;
+  if(!gelf_getehdr(elf, &ehdr) || elf_getphdrnum(elf, &phnum) != 0)
+    return false;
+
+  Elf* copy = elf_begin(out, ELF_C_WRITE, nullptr);
+  if(!copy)
+    return false;
+
+  bool ok = gelf_newehdr(copy, gelf_getclass(elf)) != nullptr && (phnum == 0 || gelf_newphdr(copy, phnum));
+  for(size_t i = 0; ok && i < phnum; ++i)
+  {
+    GElf_Phdr phdr;
+    ok = gelf_getphdr(elf, i, &phdr) && gelf_update_phdr(copy, i, &phdr);
+  }
+
+  for(Elf_Scn* scn = nullptr; ok && (scn = elf_nextscn(elf, scn)) != nullptr;)
+  {
+    GElf_Shdr shdr;
+    ok = gelf_getshdr(scn, &shdr) != nullptr;
+    if(ok && (shdr.sh_flags & SHF_COMPRESSED))
+      ok = elf_compress(scn, 0, 0) >= 0 && gelf_getshdr(scn, &shdr) != nullptr;
+
+    Elf_Scn* to = ok ? elf_newscn(copy) : nullptr;
+    ok = to && gelf_update_shdr(to, &shdr);
+    if(!ok)
+      break;
+
+    // libelf sizes the sections from their data, so the sections stripped to SHT_NOBITS, which
+    // libdwfl still uses for their addresses and sizes, get a data block without contents.
+    Elf_Data* data = elf_getdata(scn, nullptr);
+    if(!data && (shdr.sh_type != SHT_NOBITS || shdr.sh_size == 0))
+      continue;
+    Elf_Data* to_data = elf_newdata(to);
+    ok = to_data != nullptr;
+    if(ok && data)
+      *to_data = *data;
+    else if(ok)
+    {
+      to_data->d_type = ELF_T_BYTE;
+      to_data->d_size = shdr.sh_size;
+      to_data->d_align = shdr.sh_addralign ? shdr.sh_addralign : 1;
+    }
+  }
+
+  ok = ok && gelf_update_ehdr(copy, &ehdr) && elf_update(copy, ELF_C_WRITE) >= 0;
+  elf_end(copy);
+  return ok;
+}
+
+// Anonymous memory file holding a decompressed copy of the file at path, or -1 if the file has no
+// compressed section or cannot be copied.
+int decompressed_copy(const std::string& path, size_t& bytes)
+{
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if(fd < 0)
+    return -1;
+
+  elf_version(EV_CURRENT);
+  Elf* elf = elf_begin(fd, ELF_C_READ_MMAP, nullptr);
+  int out = -1;
+  if(elf && elf_kind(elf) == ELF_K_ELF && has_compressed_section(elf))
+  {
+    out = memfd_create("debuginfo", MFD_CLOEXEC);
+    struct stat st;
+    if(out >= 0 && (!write_decompressed(elf, out) || fstat(out, &st) != 0))
+    {
+      close(out);
+      out = -1;
+    }
+    else if(out >= 0)
+      bytes = st.st_size;
+  }
+
+  elf_end(elf);
+  close(fd);
+  return out;
+}
+}
+
+debug_file_cache::debug_file_cache(size_t capacity, size_t max_entries)
+  : m_capacity(capacity)
+  , m_max_entries(max_entries)
+{
+}
+
+debug_file_cache::~debug_file_cache()
+{
+  for(const entry& e : m_lru)
+    if(e.fd >= 0)
+      close(e.fd);
+}
+
+int debug_file_cache::open(const std::string& build_id, const std::string& path)
+{
+  if(build_id.empty())
+    return -1;
+
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    auto it = m_by_id.find(build_id);
+    if(it != m_by_id.end())
+    {
+      ++m_hits;
+      m_lru.splice(m_lru.begin(), m_lru, it->second);
+      return it->second->fd >= 0 ? fcntl(it->second->fd, F_DUPFD_CLOEXEC, 0) : -1;
+    }
+    ++m_misses;
+  }
+
+  // Decompress without the lock. Two threads opening the same new build-id both copy it, and the
+  // second copy is dropped.
+  size_t bytes = 0;
+  const int fd = decompressed_copy(path, bytes);
+
+  std::lock_guard<std::mutex> guard(m_lock);
+  auto [it, inserted] = m_by_id.emplace(build_id, m_lru.end());
+  if(!inserted)
+  {
+    if(fd >= 0)
+      close(fd);
+    m_lru.splice(m_lru.begin(), m_lru, it->second);
+    return it->second->fd >= 0 ? fcntl(it->second->fd, F_DUPFD_CLOEXEC, 0) : -1;
+  }
+
+  m_lru.push_front({ build_id, fd, bytes });
+  it->second = m_lru.begin();
+  m_bytes += bytes;
+  const int result = fd >= 0 ? fcntl(fd, F_DUPFD_CLOEXEC, 0) : -1;
+  evict();
+  return result;
+}
+
+// Drop the least recently opened entries until the rest fit, the newest one aside.
+void debug_file_cache::evict()
+{
+  while((m_bytes > m_capacity || m_lru.size() > m_max_entries) && m_lru.size() > 1)
+  {
+    entry& e = m_lru.back();
+    if(e.fd >= 0)
+      close(e.fd);
+    ++m_evictions;
+    m_bytes -= e.bytes;
+    m_by_id.erase(e.build_id);
+    m_lru.pop_back();
+  }
+}
+
+debug_file_cache::stats debug_file_cache::get_stats() const
+{
+  std::lock_guard<std::mutex> guard(m_lock);
+  stats s;
+  s.hits = m_hits;
+  s.misses = m_misses;
+  s.evictions = m_evictions;
+  s.entries = m_lru.size();
+  s.bytes = m_bytes;
+  s.capacity = m_capacity;
+  s.max_entries = m_max_entries;
+  return s;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Separate debug files with their compressed sections already decompressed, kept in memory by
+// build-id. libdw decompresses SHF_COMPRESSED .debug_* sections every time it opens a file, so each
+// new resolver of the same binary would pay for it again; resolvers given the same cache through
+// resolver_options::debug_cache get a descriptor of one shared decompressed copy instead, which they
+// map like the file itself.
+//
+// The copies are held in anonymous memory files. Build-ids whose file needs no copy are remembered too,
+// so the file is not scanned again. Entries go least recently opened first once the copies take more
+// than capacity bytes or there are more than max_entries of them. Evicting a copy does not disturb the
+// resolvers that have it open. Thread-safe.
+class debug_file_cache
+{
+public:
+  struct stats
+  {
+    uint64_t hits = 0;      // opens served by a copy made before
+    uint64_t misses = 0;    // opens that had to look at the file
+    uint64_t evictions = 0; // entries dropped to stay under capacity and max_entries
+    size_t entries = 0;     // build-ids known, including files that needed no copy
+    size_t bytes = 0;       // held by the copies
+    size_t capacity = 0;
+    size_t max_entries = 0;
+  };
+
+  explicit debug_file_cache(size_t capacity = size_t(1) << 30, size_t max_entries = 4096);
+  ~debug_file_cache();
+
+  debug_file_cache(const debug_file_cache&) = delete;
+  debug_file_cache& operator=(const debug_file_cache&) = delete;
+
+  // A new descriptor, owned by the caller, of the decompressed copy of the debug file at path, whose
+  // raw build-id is build_id. The copy is made by the first call for the build-id. Returns -1 if the
+  // file has no compressed section, or cannot be copied, and is to be opened as it is.
+  int open(const std::string& build_id, const std::string& path);
+
+  stats get_stats() const;
+
+private:
+  struct entry
+  {
+    std::string build_id;
+    int fd;       // -1 if the file needs no copy
+    size_t bytes;
+  };
+
+  void evict();
+
+  const size_t m_capacity;
+  const size_t m_max_entries;
+  mutable std::mutex m_lock;
+  std::list<entry> m_lru; // most recently opened first
+  std::unordered_map<std::string, std::list<entry>::iterator> m_by_id;
+  size_t m_bytes = 0;
+  uint64_t m_hits = 0;
+  uint64_t m_misses = 0;
+  uint64_t m_evictions = 0;
+};
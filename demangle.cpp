@@ -0,0 +1,35 @@
+#include "demangle.h"
+
+#include <cstdlib>
+#include <cxxabi.h>
+
+namespace
+{
+// __cxa_demangle output buffer, grown as needed and reused by every call on the same thread.
+struct demangle_buffer
+{
+  char* buffer = nullptr;
+  size_t length = 0;
+
+  ~demangle_buffer() { free(buffer); }
+};
+
+thread_local demangle_buffer t_buffer;
+}
+
+std::string_view demangle(const char* name, string_pool& pool)
+{
+  // Require GNU v3 ABI by the "_Z" prefix.
+  if(name[0] == '_' && name[1] == 'Z')
+  {
+    int status = -1;
+    char* dsymname = __cxxabiv1::__cxa_demangle(name, t_buffer.buffer, &t_buffer.length, &status);
+    if(status == 0)
+    {
+      t_buffer.buffer = dsymname;
+      return pool.intern(dsymname);
+    }
+  }
+
+  return name;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "string_pool.h"
+
+#include <string_view>
+
+// Demangle a GNU v3 ABI name and intern the result in pool. Names that are not mangled, or that fail
+// to demangle, are returned as they are. Uses a per-thread buffer, so it can be called concurrently.
+std::string_view demangle(const char* name, string_pool& pool);
@@ -0,0 +1,282 @@
+#include "elf_image.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+constexpr unsigned char native_data = ELFDATA2LSB;
+#else
+constexpr unsigned char native_data = ELFDATA2MSB;
+#endif
+
+bool exists(const std::string& path)
+{
+  struct stat st;
+  return stat(path.c_str(), &st) == 0;
+}
+}
+
+elf_image::elf_image(const std::string& path, const std::string& debug_dirs)
+  : m_file(path)
+{
+  m_ok = m_file && parse(path, debug_dirs);
+}
+
+// Array of count T at offset, or nullptr if it does not fit in the file or is misaligned.
+template<class T>
+const T* elf_image::at(uint64_t offset, uint64_t count) const
+{
+  if(offset > m_file.size() || count > (m_file.size() - offset) / sizeof(T) || offset % alignof(T) != 0)
+    return nullptr;
+  return reinterpret_cast<const T*>(m_file.data() + offset);
+}
+
+bool elf_image::parse(const std::string& path, const std::string& debug_dirs)
+{
+  static_assert(sizeof(uintptr_t) == sizeof(Elf64_Addr), "only the native ELF class is read in place");
+
+  m_ehdr = at<Elf64_Ehdr>(0, 1);
+  if(!m_ehdr || memcmp(m_ehdr->e_ident, ELFMAG, SELFMAG) != 0 || m_ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+     m_ehdr->e_ident[EI_DATA] != native_data || (m_ehdr->e_type != ET_EXEC && m_ehdr->e_type != ET_DYN) ||
+     m_ehdr->e_shentsize != sizeof(Elf64_Shdr) || m_ehdr->e_phentsize != sizeof(Elf64_Phdr))
+    return false;
+
+  // Extended numbering keeps the real counts in the first section header.
+  m_shdr = at<Elf64_Shdr>(m_ehdr->e_shoff, 1);
+  if(!m_shdr || m_ehdr->e_shoff == 0 || m_ehdr->e_phnum == PN_XNUM)
+    return false;
+  m_shnum = m_ehdr->e_shnum ? m_ehdr->e_shnum : m_shdr[0].sh_size;
+  const size_t shstrndx = m_ehdr->e_shstrndx != SHN_XINDEX ? m_ehdr->e_shstrndx : m_shdr[0].sh_link;
+  m_phnum = m_ehdr->e_phnum;
+  m_phdr = at<Elf64_Phdr>(m_ehdr->e_phoff, m_phnum);
+  if(!at<Elf64_Shdr>(m_ehdr->e_shoff, m_shnum) || !m_phdr || shstrndx >= m_shnum)
+    return false;
+
+  m_shstrtab = at<char>(m_shdr[shstrndx].sh_offset, m_shdr[shstrndx].sh_size);
+  m_shstrtab_size = m_shdr[shstrndx].sh_size;
+  if(!m_shstrtab || m_shstrtab_size == 0 || m_shstrtab[m_shstrtab_size - 1] != '\0')
+    return false;
+
+  // The module range libdwfl gives a file reported at base 0: executables stay at their link-time
+  // addresses, shared objects are moved so that their first segment starts at 0.
+  const Elf64_Phdr* first = nullptr;
+  const Elf64_Phdr* last = nullptr;
+  for(size_t i = 0; i < m_phnum; ++i)
+    if(m_phdr[i].p_type == PT_LOAD)
+    {
+      if(!first)
+        first = &m_phdr[i];
+      last = &m_phdr[i];
+    }
+  if(!first)
+    return false;
+
+  const uintptr_t vaddr = first->p_vaddr & -first->p_align;
+  m_low = m_ehdr->e_type == ET_EXEC ? vaddr : 0;
+  m_bias = m_ehdr->e_type == ET_EXEC ? 0 : -vaddr;
+  m_high = m_bias + last->p_vaddr + last->p_memsz;
+
+  // libdwfl goes through the section notes first, then the segment notes.
+  for(size_t i = 0; i < m_shnum && m_build_id.empty(); ++i)
+    if(m_shdr[i].sh_type == SHT_NOTE)
+      if(const char* notes = at<char>(m_shdr[i].sh_offset, m_shdr[i].sh_size))
+        read_build_id(notes, m_shdr[i].sh_size, m_shdr[i].sh_addralign == 8 ? 8 : 4);
+  for(size_t i = 0; i < m_phnum && m_build_id.empty(); ++i)
+    if(m_phdr[i].p_type == PT_NOTE)
+      if(const char* notes = at<char>(m_phdr[i].p_offset, m_phdr[i].p_filesz))
+        read_build_id(notes, m_phdr[i].p_filesz, m_phdr[i].p_align == 8 ? 8 : 4);
+
+  // libdwfl reads .symtab where it finds one. Without it, a separate debug file or MiniDebugInfo would
+  // be searched for a better table before it settles for .dynsym.
+  const Elf64_Shdr* symtab = nullptr;
+  for(size_t i = 0; i < m_shnum && !symtab; ++i)
+    if(m_shdr[i].sh_type == SHT_SYMTAB)
+      symtab = &m_shdr[i];
+  if(!symtab)
+  {
+    if(find_section(".gnu_debugdata") || may_have_debug_file(path, debug_dirs))
+      return false;
+    for(size_t i = 0; i < m_shnum && !symtab; ++i)
+      if(m_shdr[i].sh_type == SHT_DYNSYM)
+        symtab = &m_shdr[i];
+    if(!symtab)
+      return false;
+  }
+
+  // Extended section indexes and compressed tables are left to libdwfl.
+  for(size_t i = 0; i < m_shnum; ++i)
+    if(m_shdr[i].sh_type == SHT_SYMTAB_SHNDX)
+      return false;
+  if(symtab->sh_entsize != sizeof(Elf64_Sym) || symtab->sh_link >= m_shnum ||
+     ((symtab->sh_flags | m_shdr[symtab->sh_link].sh_flags) & SHF_COMPRESSED))
+    return false;
+
+  const Elf64_Shdr& strtab = m_shdr[symtab->sh_link];
+  m_symcount = symtab->sh_size / sizeof(Elf64_Sym);
+  m_symtab = at<Elf64_Sym>(symtab->sh_offset, m_symcount);
+  m_strtab = at<char>(strtab.sh_offset, strtab.sh_size);
+  m_strtab_size = strtab.sh_size;
+  return m_symtab && m_strtab && m_strtab_size > 0 && m_strtab[m_strtab_size - 1] == '\0';
+}
+
+void elf_image::read_build_id(const char* notes, size_t size, size_t align)
+{
+  auto aligned = [align](size_t n) { return (n + align - 1) & ~(align - 1); };
+
+  size_t pos = 0;
+  while(size - pos >= sizeof(Elf64_Nhdr))
+  {
+    Elf64_Nhdr nhdr;
+    memcpy(&nhdr, notes + pos, sizeof(nhdr));
+    const size_t name_at = pos + sizeof(nhdr);
+    const size_t desc_at = name_at + aligned(nhdr.n_namesz);
+    if(nhdr.n_namesz > size || nhdr.n_descsz > size || desc_at > size || nhdr.n_descsz > size - desc_at)
+      return;
+
+    if(nhdr.n_type == NT_GNU_BUILD_ID && nhdr.n_namesz == sizeof(ELF_NOTE_GNU) &&
+       memcmp(notes + name_at, ELF_NOTE_GNU, sizeof(ELF_NOTE_GNU)) == 0)
+    {
+      m_build_id.assign(notes + desc_at, nhdr.n_descsz);
+      return;
+    }
+
+    pos = desc_at + aligned(nhdr.n_descsz);
+  }
+}
+
+bool elf_image::may_have_debug_file(const std::string& path, const std::string& debug_dirs) const
+{
+  // The configured directories come before /usr/lib/debug, as the resolver searches them.
+  std::vector<std::string> roots;
+  for(size_t pos = 0; pos < debug_dirs.size();)
+  {
+    const size_t end = std::min(debug_dirs.find(':', pos), debug_dirs.size());
+    if(end > pos)
+      roots.push_back(debug_dirs.substr(pos, end - pos));
+    pos = end + 1;
+  }
+  const size_t nconfigured = roots.size();
+  roots.push_back("/usr/lib/debug");
+
+  // The build-id link libdwfl looks for first, and in the configured directories the flat names
+  // the resolver also tries.
+  if(!m_build_id.empty())
+  {
+    std::string hex;
+    for(unsigned char c : m_build_id)
+    {
+      char digits[3];
+      snprintf(digits, sizeof(digits), "%02x", c);
+      hex += digits;
+    }
+    for(size_t i = 0; i < roots.size(); ++i)
+    {
+      if(exists(roots[i] + "/.build-id/" + hex.substr(0, 2) + '/' + hex.substr(2) + ".debug"))
+        return true;
+      if(i < nconfigured &&
+         (exists(roots[i] + '/' + hex + ".debug") || exists(roots[i] + '/' + hex + "/debuginfo")))
+        return true;
+    }
+  }
+
+  // Then the .gnu_debuglink name, or the file name with and without .debug, in the directory of the
+  // file, in its .debug subdirectory and under the debug directories, by the absolute directory of the
+  // file and, in the configured ones, directly. Any candidate is enough to refuse: whether libdwfl
+  // accepts it depends on its checksum.
+  const size_t slash = path.rfind('/');
+  const std::string dir = slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+  const std::string base = path.substr(slash == std::string::npos ? 0 : slash + 1);
+
+  std::string names[2] = { base + ".debug", base };
+  size_t nnames = 2;
+  if(const Elf64_Shdr* debuglink = find_section(".gnu_debuglink"))
+  {
+    const char* name = at<char>(debuglink->sh_offset, debuglink->sh_size);
+    if(!name || !memchr(name, '\0', debuglink->sh_size))
+      return true;
+    names[0] = name;
+    nnames = 1;
+  }
+
+  std::string abs_dir = dir;
+  if(abs_dir.empty() || abs_dir[0] != '/')
+  {
+    char cwd[4096];
+    if(!getcwd(cwd, sizeof(cwd)))
+      return true;
+    abs_dir = std::string(cwd) + '/' + abs_dir;
+  }
+
+  for(size_t i = 0; i < nnames; ++i)
+  {
+    if(names[i] != base && exists(dir + names[i]))
+      return true;
+    if(exists(dir + ".debug/" + names[i]))
+      return true;
+    for(size_t r = 0; r < roots.size(); ++r)
+      if(exists(roots[r] + abs_dir + names[i]) || (r < nconfigured && exists(roots[r] + '/' + names[i])))
+        return true;
+  }
+
+  return false;
+}
+
+const Elf64_Shdr* elf_image::find_section(const char* name) const
+{
+  for(size_t i = 0; i < m_shnum; ++i)
+  {
+    const char* n = section_name(m_shdr[i]);
+    if(n && strcmp(n, name) == 0)
+      return &m_shdr[i];
+  }
+  return nullptr;
+}
+
+elf_image::symbol elf_image::get_symbol(size_t i) const
+{
+  const Elf64_Sym& sym = m_symtab[i];
+
+  symbol s;
+  s.name = sym.st_name < m_strtab_size ? m_strtab + sym.st_name : nullptr;
+  s.name_offset = sym.st_name;
+  s.size = sym.st_size;
+  s.shndx = sym.st_shndx;
+  s.info = sym.st_info;
+
+  // libdwfl biases everything but symbols of sections that are not loaded.
+  const bool alloc = sym.st_shndx == SHN_UNDEF || sym.st_shndx >= SHN_LORESERVE || sym.st_shndx >= m_shnum ||
+                     (m_shdr[sym.st_shndx].sh_flags & SHF_ALLOC);
+  s.value = sym.st_value + (alloc ? m_bias : 0);
+  return s;
+}
+
+const char* elf_image::section_name(const Elf64_Shdr& shdr) const
+{
+  return shdr.sh_name < m_shstrtab_size ? m_shstrtab + shdr.sh_name : nullptr;
+}
+
+uintptr_t elf_image::section_end(size_t shndx) const
+{
+  return shndx < m_shnum ? m_shdr[shndx].sh_addr + m_shdr[shndx].sh_size + m_bias : uintptr_t(-1);
+}
+
+bool elf_image::file_offset_address(uint64_t offset, uintptr_t& addr) const
+{
+  for(size_t i = 0; i < m_phnum; ++i)
+  {
+    const Elf64_Phdr& phdr = m_phdr[i];
+    if(phdr.p_type == PT_LOAD && offset >= phdr.p_offset && offset - phdr.p_offset < phdr.p_filesz)
+    {
+      addr = phdr.p_vaddr + m_bias + (offset - phdr.p_offset);
+      return true;
+    }
+  }
+
+  return false;
+}
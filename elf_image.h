@@ -0,0 +1,94 @@
+#pragma once
+
+#include "mapped_file.h"
+
+#include <elf.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// An ELF file read in place from a private mapping, without libelf or libdwfl: the headers, the symbol
+// table and the build-id, which is all the symbols level needs. Addresses are laid out the way
+// libdwfl reports the file at base 0, so they match what a Dwfl_Module of the same file returns.
+//
+// Only files whose symbols libdwfl would take from the file itself are accepted. Other classes and
+// byte orders, relocatable objects, and files that point to a separate debug file or carry
+// MiniDebugInfo are refused, and the caller is expected to fall back to libdwfl for them.
+class elf_image
+{
+public:
+  struct symbol
+  {
+    const char* name; // in the mapping
+    uint32_t name_offset;
+    uintptr_t value;  // st_value plus the load bias for symbols in allocated sections
+    uint64_t size;
+    uint16_t shndx;
+    unsigned char info;
+  };
+
+  // debug_dirs are the ':'-separated directories the resolver searches for separate debug files
+  // besides the default ones.
+  explicit elf_image(const std::string& path, const std::string& debug_dirs = std::string());
+  elf_image(const elf_image&) = delete;
+  elf_image& operator=(const elf_image&) = delete;
+
+  explicit operator bool() const { return m_ok; }
+
+  // Address range and load bias of the file, as dwfl_module_info would give them.
+  uintptr_t low() const { return m_low; }
+  uintptr_t high() const { return m_high; }
+  uintptr_t bias() const { return m_bias; }
+
+  uint16_t type() const { return m_ehdr->e_type; }
+
+  // Raw build-id bytes, empty if the file has none.
+  const std::string& build_id() const { return m_build_id; }
+
+  // Entries of .symtab, or of .dynsym for a stripped file. Entry 0 is the null symbol.
+  size_t symbol_count() const { return m_symcount; }
+  symbol get_symbol(size_t i) const;
+
+  // String table the symbol names are in.
+  const char* strings() const { return m_strtab; }
+
+  size_t section_count() const { return m_shnum; }
+  const Elf64_Shdr& section(size_t i) const { return m_shdr[i]; }
+
+  // Name of a section from the section header string table, or nullptr.
+  const char* section_name(const Elf64_Shdr& shdr) const;
+
+  // End of section shndx plus the bias, or uintptr_t(-1) if there is no such section.
+  uintptr_t section_end(size_t shndx) const;
+
+  // Link-time address of the byte at file offset, from the PT_LOAD segment that contains it.
+  bool file_offset_address(uint64_t offset, uintptr_t& addr) const;
+
+private:
+  bool parse(const std::string& path, const std::string& debug_dirs);
+  bool may_have_debug_file(const std::string& path, const std::string& debug_dirs) const;
+  const Elf64_Shdr* find_section(const char* name) const;
+  template<class T> const T* at(uint64_t offset, uint64_t count) const;
+  void read_build_id(const char* notes, size_t size, size_t align);
+
+  mapped_file m_file;
+  bool m_ok = false;
+  const Elf64_Ehdr* m_ehdr = nullptr;
+  const Elf64_Phdr* m_phdr = nullptr;
+  size_t m_phnum = 0;
+  const Elf64_Shdr* m_shdr = nullptr;
+  size_t m_shnum = 0;
+  const char* m_shstrtab = nullptr;
+  size_t m_shstrtab_size = 0;
+
+  const Elf64_Sym* m_symtab = nullptr;
+  size_t m_symcount = 0;
+  const char* m_strtab = nullptr;
+  size_t m_strtab_size = 0;
+
+  uintptr_t m_low = 0;
+  uintptr_t m_high = 0;
+  uintptr_t m_bias = 0;
+  std::string m_build_id;
+};
@@ -0,0 +1,128 @@
+#include "frame_cache.h"
+
+static size_t round_up_pow2(size_t n)
+{
+  size_t p = 1;
+  while(p < n)
+    p <<= 1;
+  return p;
+}
+
+frame_cache::frame_cache(size_t capacity, size_t shards)
+{
+  if(capacity == 0)
+    return;
+
+  m_nshards = round_up_pow2(shards ? shards : 1);
+  m_sets = round_up_pow2((capacity + m_nshards * ways - 1) / (m_nshards * ways));
+  m_shards.reset(new shard[m_nshards]);
+  for(size_t i = 0; i < m_nshards; ++i)
+    m_shards[i].slots.resize(m_sets * ways);
+}
+
+frame_cache::slot* frame_cache::locate(uintptr_t granule, shard*& sh)
+{
+  // Fibonacci hashing: the high bits pick the shard, the low bits the set.
+  const uint64_t h = uint64_t(granule) * 0x9E3779B97F4A7C15ull;
+  sh = &m_shards[(h >> 40) & (m_nshards - 1)];
+  return &sh->slots[(h & (m_sets - 1)) * ways];
+}
+
+// The slot of set holding a range with pc in it, looked up in granule, or nullptr.
+frame_cache::slot* frame_cache::match(slot* set, uintptr_t granule, uintptr_t pc)
+{
+  for(size_t w = 0; w < ways; ++w)
+  {
+    slot& s = set[w];
+    if(s.stamp && s.granule == granule && pc >= s.e.lo && pc < s.e.hi)
+      return &s;
+  }
+  return nullptr;
+}
+
+bool frame_cache::lookup(uintptr_t pc, entry& e)
+{
+  if(!m_nshards)
+    return false;
+
+  const uintptr_t granule = pc >> granule_bits;
+  shard* sh;
+  slot* set = locate(granule, sh);
+
+  std::lock_guard<std::mutex> guard(sh->lock);
+  if(slot* s = match(set, granule, pc))
+  {
+    s->stamp = ++sh->clock;
+    ++sh->hits;
+    e = s->e;
+    return true;
+  }
+
+  ++sh->misses;
+  return false;
+}
+
+void frame_cache::insert(uintptr_t pc, const entry& e)
+{
+  if(!m_nshards)
+    return;
+
+  // Store the range under every granule it covers, so that any pc in it hits with a single set probe.
+  // For a long function, only the spread_granules granules on either side of pc.
+  const uintptr_t granule = pc >> granule_bits;
+  uintptr_t first = e.lo >> granule_bits;
+  uintptr_t last = e.hi > e.lo ? (e.hi - 1) >> granule_bits : first;
+  if(granule < first || granule > last)
+    first = last = granule;
+  if(granule - first > spread_granules)
+    first = granule - spread_granules;
+  if(last - granule > spread_granules)
+    last = granule + spread_granules;
+
+  for(uintptr_t g = first; g <= last; ++g)
+    store(g, e);
+}
+
+void frame_cache::store(uintptr_t granule, const entry& e)
+{
+  shard* sh;
+  slot* set = locate(granule, sh);
+
+  std::lock_guard<std::mutex> guard(sh->lock);
+
+  // Reuse a slot already holding this range (another thread may have inserted it), else an empty
+  // slot, else the least recently used one.
+  slot* victim = &set[0];
+  for(size_t w = 0; w < ways; ++w)
+  {
+    slot& s = set[w];
+    if(s.stamp && s.granule == granule && s.e.lo == e.lo && s.e.hi == e.hi)
+    {
+      victim = &s;
+      break;
+    }
+    if(victim->stamp && (!s.stamp || s.stamp < victim->stamp))
+      victim = &s;
+  }
+
+  if(victim->stamp && !(victim->granule == granule && victim->e.lo == e.lo))
+    ++sh->evictions;
+
+  victim->granule = granule;
+  victim->stamp = ++sh->clock;
+  victim->e = e;
+}
+
+frame_cache::stats frame_cache::get_stats() const
+{
+  stats st;
+  st.capacity = m_nshards * m_sets * ways;
+  for(size_t i = 0; i < m_nshards; ++i)
+  {
+    std::lock_guard<std::mutex> guard(m_shards[i].lock);
+    st.hits += m_shards[i].hits;
+    st.misses += m_shards[i].misses;
+    st.evictions += m_shards[i].evictions;
+  }
+  return st;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+// Bounded, thread-safe cache of per-function resolution results. An entry describes a whole symbol
+// range [lo, hi): once one pc in a function has been resolved, every other pc in the same function
+// finds its name and section here and only needs a line table lookup.
+//
+// The cache is set-associative. A pc is mapped to a set by its granule (pc >> granule_bits), so a
+// function is stored under every granule it covers, so a lookup probes one set only. A function longer
+// than that is stored under the spread_granules granules on either side of the inserted pc, and pcs
+// further away miss once and add their own. Sets are spread over independently locked shards to keep
+// lookups from different threads apart.
+class frame_cache
+{
+public:
+  struct entry
+  {
+    uintptr_t lo = 0;
+    uintptr_t hi = 0;
+    std::string_view name;    // must outlive the cache
+    std::string_view section; // idem
+    bool has_inlines = false; // the function may contain inlined code, inline depth varies within it
+  };
+
+  struct stats
+  {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t capacity = 0;
+  };
+
+  // capacity is the maximum number of entries, rounded up to a whole number of sets per shard.
+  // A capacity of 0 disables the cache.
+  explicit frame_cache(size_t capacity, size_t shards = 16);
+
+  bool lookup(uintptr_t pc, entry& e);
+  void insert(uintptr_t pc, const entry& e);
+
+  stats get_stats() const;
+
+private:
+  static constexpr unsigned granule_bits = 8;
+  static constexpr uintptr_t spread_granules = 8;
+  static constexpr size_t ways = 4;
+
+  struct slot
+  {
+    uintptr_t granule = 0;
+    uint64_t stamp = 0; // last use, 0 if the slot is empty
+    entry e;
+  };
+
+  struct alignas(64) shard
+  {
+    mutable std::mutex lock;
+    std::vector<slot> slots; // m_sets * ways
+    uint64_t clock = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+  };
+
+  // Returns the shard and the first slot of the set for pc's granule.
+  slot* locate(uintptr_t granule, shard*& sh);
+  static slot* match(slot* set, uintptr_t granule, uintptr_t pc);
+  void store(uintptr_t granule, const entry& e);
+
+  std::unique_ptr<shard[]> m_shards;
+  size_t m_nshards = 0; // power of two
+  size_t m_sets = 0;    // per shard, power of two
+};
@@ -0,0 +1,168 @@
+// Write the sources of a large synthetic test binary for the benchmarks, a scaled up cavia:
+//
+//   gen_cavia dir units functions
+//
+// writes dir/main.cpp and dir/unit_0.cpp ... dir/unit_<units-1>.cpp. Every unit is its own CU of
+// `functions` plain functions, each calling always_inline helpers nested several levels deep and one
+// instance of a function template, so the binary has thousands of symbols, long mangled names, large
+// line tables and deep inline chains. main calls everything so nothing is dropped.
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+
+namespace
+{
+const char* const types[] = { "uint64_t", "uint32_t", "uint16_t" };
+
+void write_unit(std::ostream& out, unsigned unit, unsigned functions)
+{
+  out << "// generated by gen_cavia, do not edit\n"
+         "#include <cstdint>\n"
+         "\n"
+         "namespace cavia_"
+      << unit
+      << "\n"
+         "{\n"
+         "template<typename T, int N>\n"
+         "struct mixer\n"
+         "{\n"
+         "  static inline __attribute__((always_inline)) T apply(T x)\n"
+         "  {\n"
+         "    return mixer<T, N - 1>::apply(T(x * 0x9e3779b97f4a7c15ull) ^ T(x >> (N % 13 + 1))) + N;\n"
+         "  }\n"
+         "};\n"
+         "\n"
+         "template<typename T>\n"
+         "struct mixer<T, 0>\n"
+         "{\n"
+         "  static inline __attribute__((always_inline)) T apply(T x) { return x; }\n"
+         "};\n"
+         "\n"
+         "template<typename T, int N>\n"
+         "__attribute__((noinline)) T reduce(T x)\n"
+         "{\n"
+         "  for(int i = 0; i < N % 7 + 1; ++i)\n"
+         "    x = mixer<T, N % 5 + 1>::apply(x);\n"
+         "  return x;\n"
+         "}\n";
+
+  for(unsigned i = 0; i < functions; ++i)
+  {
+    const char* type = types[i % 3];
+    out << "\n"
+           "static inline __attribute__((always_inline)) uint64_t leaf_"
+        << i << "(uint64_t x)\n"
+        << "{\n"
+        << "  return (x ^ " << i * 2654435761u << "u) * " << 2 * i + 1 << "u;\n"
+        << "}\n"
+        << "\n"
+        << "static inline __attribute__((always_inline)) uint64_t middle_" << i << "(uint64_t x)\n"
+        << "{\n"
+        << "  return leaf_" << i << "(x) + leaf_" << i << "(x >> 3);\n"
+        << "}\n"
+        << "\n"
+        << "__attribute__((noinline)) uint64_t function_" << i << "(uint64_t x)\n"
+        << "{\n"
+        << "  x = middle_" << i << "(x);\n"
+        << "  if(x & 1)\n"
+        << "    x = reduce<" << type << ", " << i % 97 << ">(" << type << "(x));\n"
+        << "  return x;\n"
+        << "}\n";
+  }
+
+  out << "}\n"
+         "\n"
+         "uint64_t cavia_unit_"
+      << unit << "(uint64_t x)\n"
+      << "{\n";
+  for(unsigned i = 0; i < functions; ++i)
+    out << "  x = cavia_" << unit << "::function_" << i << "(x);\n";
+  out << "  return x;\n"
+         "}\n";
+}
+
+void write_main(std::ostream& out, unsigned units)
+{
+  out << "// generated by gen_cavia, do not edit\n"
+         "#include <cstdint>\n"
+         "#include <cstdio>\n"
+         "\n";
+  for(unsigned unit = 0; unit < units; ++unit)
+    out << "uint64_t cavia_unit_" << unit << "(uint64_t x);\n";
+  out << "\n"
+         "int main(int argc, char* argv[])\n"
+         "{\n"
+         "  uint64_t x = argc;\n";
+  for(unsigned unit = 0; unit < units; ++unit)
+    out << "  x = cavia_unit_" << unit << "(x);\n";
+  out << "  printf(\"%llx\\n\", (unsigned long long)x);\n"
+         "}\n";
+}
+
+// Replace path only if its content changes, so the build does not recompile unchanged units.
+bool write_file(const std::filesystem::path& path, const std::string& content)
+{
+  {
+    std::ifstream in(path, std::ios::binary);
+    std::string old((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if(in.is_open() && old == content)
+      return true;
+  }
+
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out << content;
+  out.close();
+  if(!out)
+  {
+    std::cerr << path.string() << ": " << strerror(errno) << '\n';
+    return false;
+  }
+  return true;
+}
+}
+
+int main(int argc, char* argv[])
+{
+  if(argc != 4)
+  {
+    std::cerr << "usage: " << argv[0] << " dir units functions\n";
+    return 2;
+  }
+
+  const std::filesystem::path dir = argv[1];
+  const unsigned units = strtoul(argv[2], nullptr, 10);
+  const unsigned functions = strtoul(argv[3], nullptr, 10);
+  if(units == 0 || functions == 0)
+  {
+    std::cerr << "units and functions must be positive\n";
+    return 2;
+  }
+
+  std::error_code ec;
+  std::filesystem::create_directories(dir, ec);
+  if(ec)
+  {
+    std::cerr << dir.string() << ": " << ec.message() << '\n';
+    return 1;
+  }
+
+  for(unsigned unit = 0; unit < units; ++unit)
+  {
+    std::ostringstream out;
+    write_unit(out, unit, functions);
+    if(!write_file(dir / ("unit_" + std::to_string(unit) + ".cpp"), out.str()))
+      return 1;
+  }
+
+  std::ostringstream out;
+  write_main(out, units);
+  return write_file(dir / "main.cpp", out.str()) ? 0 : 1;
+}
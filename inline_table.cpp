@@ -0,0 +1,144 @@
+#include "inline_table.h"
+
+#include <algorithm>
+#include <iterator>
+#include <mutex>
+
+namespace
+{
+constexpr uint32_t npos32 = uint32_t(-1);
+}
+
+size_t inline_table::add_node(size_t parent, const inline_frame& frame)
+{
+  m_parent.push_back(parent == npos ? npos32 : uint32_t(parent));
+  m_frames.push_back(frame);
+  return m_parent.size() - 1;
+}
+
+void inline_table::add_range(size_t node, uintptr_t lo, uintptr_t hi)
+{
+  if(lo < hi)
+    m_ranges.push_back({ lo, hi, uint32_t(node) });
+}
+
+void inline_table::finish()
+{
+  // Chains, innermost first. Parents come before their children, so a node's chain is its own frame
+  // followed by its parent's chain.
+  m_chain_at.resize(m_parent.size());
+  m_depth.resize(m_parent.size());
+  for(size_t n = 0; n < m_parent.size(); ++n)
+  {
+    m_chain_at[n] = m_chains.size();
+    m_chains.push_back(m_frames[n]);
+    if(m_parent[n] != npos32)
+    {
+      const uint32_t p = m_parent[n];
+      for(uint32_t k = 0; k < m_depth[p]; ++k)
+        m_chains.push_back(m_chains[m_chain_at[p] + k]);
+    }
+    m_depth[n] = m_chains.size() - m_chain_at[n];
+  }
+
+  // Paint the ranges in the order they were added, outer nodes first, so the innermost node covering
+  // an address is the one left there. Each boundary holds the node from it up to the next boundary.
+  std::map<uintptr_t, uint32_t> paint;
+  for(const node_range& r : m_ranges)
+  {
+    auto after = paint.upper_bound(r.hi);
+    const uint32_t at_hi = after == paint.begin() ? 0 : std::prev(after)->second;
+    paint.erase(paint.lower_bound(r.lo), paint.lower_bound(r.hi));
+    paint.emplace(r.hi, at_hi);
+    paint[r.lo] = r.node + 1;
+  }
+
+  m_seg_start.reserve(paint.size());
+  m_seg_node.reserve(paint.size());
+  for(const auto& [start, node] : paint)
+  {
+    // Merge neighbours with the same node.
+    if(!m_seg_node.empty() && m_seg_node.back() == node)
+      continue;
+    m_seg_start.push_back(start);
+    m_seg_node.push_back(node);
+  }
+
+  m_frames = std::vector<inline_frame>();
+  m_ranges = std::vector<node_range>();
+}
+
+std::span<const inline_frame> inline_table::chain(uintptr_t pc) const
+{
+  auto it = std::upper_bound(m_seg_start.begin(), m_seg_start.end(), pc);
+  if(it == m_seg_start.begin())
+    return {};
+
+  const uint32_t node = m_seg_node[it - m_seg_start.begin() - 1];
+  if(node == 0)
+    return {};
+
+  return { m_chains.data() + m_chain_at[node - 1], m_depth[node - 1] };
+}
+
+size_t inline_table::memory_usage() const
+{
+  return sizeof(*this) + m_function_ranges.capacity() * sizeof(range) +
+         (m_parent.capacity() + m_chain_at.capacity() + m_depth.capacity() + m_seg_node.capacity()) * sizeof(uint32_t) +
+         m_chains.capacity() * sizeof(inline_frame) + m_seg_start.capacity() * sizeof(uintptr_t);
+}
+
+const inline_table* inline_cache::find(uintptr_t pc) const
+{
+  std::shared_lock<std::shared_mutex> guard(m_lock);
+  return find_locked(pc);
+}
+
+const inline_table* inline_cache::find_locked(uintptr_t pc) const
+{
+  auto it = m_by_addr.upper_bound(pc);
+  if(it == m_by_addr.begin() || pc >= (--it)->second.hi)
+    return nullptr;
+  return it->second.table;
+}
+
+const inline_table* inline_cache::insert(std::unique_ptr<inline_table> table)
+{
+  std::unique_lock<std::shared_mutex> guard(m_lock);
+  for(const inline_table::range& r : table->function_ranges())
+    if(const inline_table* existing = find_locked(r.lo))
+      return existing;
+
+  // The map must not overlap for find_locked(): where another function already has part of a range,
+  // as a symbol-sized table of code without DWARF can, that part stays with it.
+  for(const inline_table::range& r : table->function_ranges())
+  {
+    uintptr_t lo = r.lo;
+    auto it = m_by_addr.lower_bound(lo);
+    if(it != m_by_addr.begin() && std::prev(it)->second.hi > lo)
+      lo = std::prev(it)->second.hi;
+
+    while(lo < r.hi)
+    {
+      const uintptr_t hi = it != m_by_addr.end() ? std::min(r.hi, it->first) : r.hi;
+      if(lo < hi)
+        m_by_addr.emplace_hint(it, lo, entry{ hi, table.get() });
+      if(it == m_by_addr.end())
+        break;
+      lo = std::max(lo, it->second.hi);
+      ++it;
+    }
+  }
+
+  m_tables.push_back(std::move(table));
+  return m_tables.back().get();
+}
+
+size_t inline_cache::memory_usage() const
+{
+  std::shared_lock<std::shared_mutex> guard(m_lock);
+  size_t bytes = m_by_addr.size() * (sizeof(std::pair<const uintptr_t, entry>) + 4 * sizeof(void*));
+  for(const auto& t : m_tables)
+    bytes += t->memory_usage();
+  return bytes;
+}
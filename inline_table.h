@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <span>
+#include <string_view>
+#include <vector>
+
+// One level of inlining at an address: function was inlined into the next outer frame, at the call
+// site call_file:call_line:call_column.
+struct inline_frame
+{
+  std::string_view function;
+  std::string_view call_file;
+  uint32_t call_line = 0;
+  uint32_t call_column = 0;
+};
+
+// The inlined subroutines of one function, flattened so that the inline chain at any pc of the
+// function is found with one binary search. Built from a single walk over the function's DIE tree:
+// every inlined subroutine becomes a node with its ranges, and the ranges are painted over each other
+// outermost first, leaving for each address segment the innermost node covering it.
+class inline_table
+{
+public:
+  static constexpr size_t npos = size_t(-1);
+
+  // Building. Nodes must be added before their children, and each node's ranges before the nodes
+  // nested in it.
+  void set_function(std::string_view name) { m_function = name; }
+  void add_function_range(uintptr_t lo, uintptr_t hi) { m_function_ranges.push_back({ lo, hi }); }
+  size_t add_node(size_t parent, const inline_frame& frame);
+  void add_range(size_t node, uintptr_t lo, uintptr_t hi);
+  void finish();
+
+  // Inlined frames at pc, innermost first. Empty if pc is not in inlined code.
+  std::span<const inline_frame> chain(uintptr_t pc) const;
+
+  // Name of the function the table was built for.
+  std::string_view function() const { return m_function; }
+
+  // Whether the function contains any inlined code.
+  bool empty() const { return m_parent.empty(); }
+
+  struct range
+  {
+    uintptr_t lo;
+    uintptr_t hi;
+  };
+  const std::vector<range>& function_ranges() const { return m_function_ranges; }
+
+  size_t memory_usage() const;
+
+private:
+  struct node_range
+  {
+    uintptr_t lo;
+    uintptr_t hi;
+    uint32_t node;
+  };
+
+  std::string_view m_function;
+  std::vector<range> m_function_ranges;
+
+  // Build input, released by finish().
+  std::vector<inline_frame> m_frames; // by node
+  std::vector<node_range> m_ranges;   // in the order added
+
+  std::vector<uint32_t> m_parent;      // by node, npos32 for the outermost inline
+  std::vector<uint32_t> m_chain_at;    // by node, offset of its chain in m_chains
+  std::vector<uint32_t> m_depth;       // by node, length of its chain
+  std::vector<inline_frame> m_chains;  // chain of every node, innermost first
+
+  std::vector<uintptr_t> m_seg_start; // sorted
+  std::vector<uint32_t> m_seg_node;   // node + 1 from m_seg_start[i] on, 0 for none
+};
+
+// Inline tables by the address ranges of their function. Tables are immutable once inserted and live
+// as long as the cache, so the chains they return can be kept. Safe to use from several threads.
+class inline_cache
+{
+public:
+  const inline_table* find(uintptr_t pc) const;
+
+  // Make table findable over its function ranges, except the parts tables inserted before already
+  // cover. If a table covering the same function was inserted meanwhile, that one is returned and
+  // table is dropped.
+  const inline_table* insert(std::unique_ptr<inline_table> table);
+
+  size_t memory_usage() const;
+
+private:
+  const inline_table* find_locked(uintptr_t pc) const;
+
+  struct entry
+  {
+    uintptr_t hi;
+    const inline_table* table;
+  };
+
+  mutable std::shared_mutex m_lock;
+  std::map<uintptr_t, entry> m_by_addr; // by lo
+  std::vector<std::unique_ptr<inline_table>> m_tables;
+};
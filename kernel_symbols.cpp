@@ -0,0 +1,230 @@
+#include "kernel_symbols.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string_view>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace
+{
+// A symbol as parsed, before sorting: its name is still in the text of the file.
+struct raw_symbol
+{
+  uintptr_t start;
+  uint32_t name; // offset into the text
+  uint16_t length;
+  uint16_t module;
+  uint32_t rank; // of the name among the aliases at start, lower is better
+  uint32_t line; // order in the file, for aliases of equal rank
+};
+
+// Ranks names the way perf chooses between aliases: global before weak before local, then the
+// fewer leading underscores.
+uint32_t rank_of(char type, std::string_view name)
+{
+  const uint32_t binding = type == 'T' ? 0 : type == 'W' || type == 'w' ? 1 : 2;
+  const uint32_t underscores = std::min<size_t>(name.find_first_not_of('_'), 255);
+  return binding << 8 | underscores;
+}
+
+int hex_digit(char c)
+{
+  if(c >= '0' && c <= '9')
+    return c - '0';
+  if(c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if(c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+}
+
+kernel_symbols::kernel_symbols(const std::string& path)
+{
+  // Files in /proc report a size of 0: read to the end.
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if(fd < 0)
+    throw std::runtime_error(path + ": " + strerror(errno));
+
+  std::string text;
+  size_t got = 0;
+  for(;;)
+  {
+    if(text.size() - got < 64 * 1024)
+      text.resize(std::max<size_t>(2 * text.size(), 1 << 20));
+    const ssize_t n = read(fd, text.data() + got, text.size() - got);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0)
+      break;
+    got += n;
+  }
+  close(fd);
+  text.resize(got);
+
+  parse(text);
+  if(m_start.empty())
+    throw std::runtime_error(path + ": no kernel symbol addresses, hidden by kptr_restrict?");
+}
+
+// Parse lines of "address type name" followed by "\t[module]" for symbols of modules.
+void kernel_symbols::parse(const std::string& text)
+{
+  std::vector<raw_symbol> syms;
+  syms.reserve(text.size() / 40);
+  m_modules.push_back({ "[kernel.kallsyms]", 0, 0 });
+
+  std::unordered_map<std::string_view, uint16_t> module_ids;
+  std::string_view last_module;
+  uint16_t last_id = 0;
+
+  const char* const data = text.data();
+  const char* const text_end = data + text.size();
+  uint32_t line_no = 0;
+  for(const char* p = data; p < text_end; ++line_no)
+  {
+    const char* eol = static_cast<const char*>(memchr(p, '\n', text_end - p));
+    if(!eol)
+      eol = text_end;
+    const char* line = p;
+    p = eol + 1;
+
+    uintptr_t start = 0;
+    int digit;
+    for(; line < eol && (digit = hex_digit(*line)) >= 0; ++line)
+      start = start << 4 | digit;
+
+    // Text symbols only; an address of 0 is one kptr_restrict hid.
+    if(start == 0 || eol - line < 4 || line[0] != ' ' || line[2] != ' ')
+      continue;
+    const char type = line[1];
+    if(type != 't' && type != 'T' && type != 'w' && type != 'W')
+      continue;
+
+    const char* name = line + 3;
+    const char* tab = static_cast<const char*>(memchr(name, '\t', eol - name));
+    const std::string_view symbol(name, (tab ? tab : eol) - name);
+    if(symbol.empty() || symbol.size() > UINT16_MAX)
+      continue;
+
+    uint16_t module = 0;
+    if(tab && tab + 2 < eol && tab[1] == '[')
+    {
+      const char* close = static_cast<const char*>(memchr(tab, ']', eol - tab));
+      const std::string_view module_name(tab + 1, (close ? close + 1 : eol) - tab - 1);
+      if(module_name != last_module)
+      {
+        auto it = module_ids.find(module_name);
+        if(it == module_ids.end())
+        {
+          if(m_modules.size() > UINT16_MAX)
+            continue;
+          it = module_ids.emplace(module_name, uint16_t(m_modules.size())).first;
+          m_modules.push_back({ std::string(module_name), 0, 0 });
+        }
+        last_module = module_name;
+        last_id = it->second;
+      }
+      module = last_id;
+    }
+
+    syms.push_back({ start, uint32_t(name - data), uint16_t(symbol.size()), module, rank_of(type, symbol),
+                     line_no });
+  }
+
+  // The kernel lists its own symbols sorted, and the modules after them in no order: only those are
+  // sorted, then merged in.
+  auto before = [](const raw_symbol& a, const raw_symbol& b) { return a.start < b.start; };
+  auto unsorted = std::is_sorted_until(syms.begin(), syms.end(), before);
+  if(unsorted != syms.end())
+  {
+    std::sort(unsorted, syms.end(), before);
+    std::inplace_merge(syms.begin(), unsorted, syms.end(), before);
+  }
+
+  // Keep the best name at each address.
+  size_t kept = 0;
+  for(size_t i = 0; i < syms.size(); ++i)
+  {
+    if(kept > 0 && syms[kept - 1].start == syms[i].start)
+    {
+      raw_symbol& best = syms[kept - 1];
+      if(syms[i].rank < best.rank || (syms[i].rank == best.rank && syms[i].line < best.line))
+        best = syms[i];
+    }
+    else
+      syms[kept++] = syms[i];
+  }
+  syms.resize(kept);
+
+  m_start.reserve(syms.size());
+  m_size.reserve(syms.size());
+  m_name.reserve(syms.size());
+  m_module.reserve(syms.size());
+  size_t bytes = 0;
+  for(const raw_symbol& s : syms)
+    bytes += s.length + 1;
+  m_strings.reserve(bytes);
+
+  for(size_t i = 0; i < syms.size(); ++i)
+  {
+    const raw_symbol& s = syms[i];
+    uintptr_t size = ((s.start + 4096 + 4095) & ~uintptr_t(4095)) - s.start;
+    if(i + 1 < syms.size() && syms[i + 1].module == s.module)
+      size = syms[i + 1].start - s.start;
+    size = std::min<uintptr_t>(size, UINT32_MAX);
+    const uintptr_t end = s.start + size;
+
+    m_start.push_back(s.start);
+    m_size.push_back(uint32_t(size));
+    m_name.push_back(uint32_t(m_strings.size()));
+    m_module.push_back(s.module);
+    m_strings.append(data + s.name, s.length);
+    m_strings += '\0';
+
+    module_range& m = m_modules[s.module];
+    if(m.hi == 0)
+      m.lo = s.start;
+    m.hi = std::max(m.hi, end);
+  }
+
+  if(!m_start.empty())
+  {
+    m_low = m_start.front();
+    m_high = m_start.back() + m_size.back();
+  }
+}
+
+int kernel_symbols::lookup(uintptr_t addr, resolved_frame& frame) const
+{
+  frame = {};
+  frame.address = addr;
+
+  const size_t i = std::upper_bound(m_start.begin(), m_start.end(), addr) - m_start.begin();
+  if(i == 0 || addr - m_start[i - 1] >= m_size[i - 1])
+    return frame.status = 1;
+
+  frame.name = std::string_view(m_strings.data() + m_name[i - 1]);
+  frame.offset = addr - m_start[i - 1];
+  frame.section = m_modules[m_module[i - 1]].name;
+  return frame.status = 0;
+}
+
+int kernel_symbols::resolve(uintptr_t addr, resolved_frame& frame, resolve_level)
+{
+  return lookup(addr, frame);
+}
+
+size_t kernel_symbols::resolve_batch(std::span<const uintptr_t> addrs, std::span<resolved_frame> results,
+                                     resolve_level)
+{
+  const size_t n = std::min(addrs.size(), results.size());
+  size_t failed = 0;
+  for(size_t i = 0; i < n; ++i)
+    failed += lookup(addrs[i], results[i]) != 0;
+  return failed;
+}
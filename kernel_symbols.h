@@ -0,0 +1,68 @@
+#pragma once
+
+#include "resolver_backend.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+// Kernel addresses resolved from /proc/kallsyms, or a copy of it saved with a recording. The file is
+// parsed once into sorted arrays: the start addresses, searched alone, then the size, name and module
+// of each symbol, with the names packed in one string table and the module names interned. Parsing
+// needs no allocation per symbol, so a kernel with a few hundred thousand symbols loads in tens of
+// milliseconds.
+//
+// Only text symbols are kept. kallsyms gives no sizes: a symbol ends where the next one of the same
+// module starts, and the last one of a module at the page boundary after it, as perf does. Of the
+// aliases at one address, a global name is preferred to a weak and a weak to a local one.
+//
+// Lookups stop at resolve_level::symbols whatever the level asked. The section of a frame is the
+// module the address is in, "[kernel.kallsyms]" for the kernel itself. Immutable once constructed,
+// so any number of threads can look up concurrently.
+class kernel_symbols final : public resolver_backend
+{
+public:
+  struct module_range
+  {
+    std::string name; // in brackets, the way perf names kernel modules
+    uintptr_t lo;     // from the first symbol of the module
+    uintptr_t hi;     // to the end of its last one
+  };
+
+  // Throws std::runtime_error if the file cannot be read, or has no symbol with an address, as when
+  // kptr_restrict hides them from the reader.
+  explicit kernel_symbols(const std::string& path = "/proc/kallsyms");
+  kernel_symbols(const kernel_symbols&) = delete;
+  kernel_symbols& operator=(const kernel_symbols&) = delete;
+
+  const char* name() const override { return "kallsyms"; }
+
+  int resolve(uintptr_t addr, resolved_frame& frame, resolve_level level) override;
+  size_t resolve_batch(std::span<const uintptr_t> addrs, std::span<resolved_frame> results,
+                       resolve_level level) override;
+
+  // Whether addr is between the first symbol and the end of the last one, of any module.
+  bool contains(uintptr_t addr) const { return addr >= m_low && addr < m_high; }
+
+  size_t size() const { return m_start.size(); }
+
+  // The kernel first, then the modules in the order kallsyms lists them.
+  std::span<const module_range> modules() const { return m_modules; }
+
+private:
+  void parse(const std::string& text);
+  int lookup(uintptr_t addr, resolved_frame& frame) const;
+
+  // One entry per symbol, sorted by address.
+  std::vector<uintptr_t> m_start;
+  std::vector<uint32_t> m_size;
+  std::vector<uint32_t> m_name;   // offset into m_strings
+  std::vector<uint16_t> m_module; // index into m_modules
+
+  std::string m_strings; // NUL separated names
+  std::vector<module_range> m_modules;
+  uintptr_t m_low = 0;
+  uintptr_t m_high = 0;
+};
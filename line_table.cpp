@@ -0,0 +1,194 @@
+#include "line_table.h"
+
+#include <algorithm>
+#include <mutex>
+
+uint32_t line_table::add_file(std::string_view name)
+{
+  m_files.push_back(name);
+  return m_files.size() - 1;
+}
+
+void line_table::add_row(uintptr_t addr, uint32_t file, uint32_t line, uint32_t column)
+{
+  if(!m_in_sequence)
+  {
+    m_sequence_start = addr;
+    m_in_sequence = true;
+  }
+
+  // Only the last row at an address is ever found.
+  if(!m_addr.empty() && m_addr.back() == addr)
+  {
+    m_file.back() = file;
+    m_line.back() = line;
+    m_column.back() = column;
+    return;
+  }
+
+  m_addr.push_back(addr);
+  m_file.push_back(file);
+  m_line.push_back(line);
+  m_column.push_back(column);
+}
+
+void line_table::add_end_sequence(uintptr_t addr)
+{
+  if(m_in_sequence && m_sequence_start < addr)
+    m_sequences.push_back({ m_sequence_start, addr });
+  m_in_sequence = false;
+
+  if(!m_addr.empty() && m_addr.back() == addr)
+  {
+    m_file.back() = end_sequence;
+    return;
+  }
+
+  m_addr.push_back(addr);
+  m_file.push_back(end_sequence);
+  m_line.push_back(0);
+  m_column.push_back(0);
+}
+
+void line_table::clip_sequences(std::vector<range> ranges)
+{
+  // Both lists sorted by lo, then walked together: whichever of the two current ranges ends first
+  // cannot meet anything further in the other list.
+  auto by_lo = [](const range& a, const range& b) { return a.lo < b.lo; };
+  std::sort(ranges.begin(), ranges.end(), by_lo);
+  if(!std::is_sorted(m_sequences.begin(), m_sequences.end(), by_lo))
+    std::sort(m_sequences.begin(), m_sequences.end(), by_lo);
+
+  std::vector<range> clipped;
+  clipped.reserve(m_sequences.size());
+  size_t s = 0, r = 0;
+  while(s < m_sequences.size() && r < ranges.size())
+  {
+    const range& seq = m_sequences[s];
+    const uintptr_t lo = std::max(seq.lo, ranges[r].lo);
+    const uintptr_t hi = std::min(seq.hi, ranges[r].hi);
+    if(lo < hi)
+      clipped.push_back({ lo, hi });
+    if(seq.hi < ranges[r].hi)
+      ++s;
+    else
+      ++r;
+  }
+
+  m_sequences = std::move(clipped);
+}
+
+bool line_table::find(uintptr_t pc, line& l) const
+{
+  auto it = std::upper_bound(m_addr.begin(), m_addr.end(), pc);
+  if(it == m_addr.begin())
+    return false;
+
+  const size_t i = it - m_addr.begin() - 1;
+  if(m_file[i] == end_sequence)
+    return false;
+
+  l.file = m_files[m_file[i]];
+  l.line = m_line[i];
+  l.column = m_column[i];
+  return true;
+}
+
+size_t line_table::memory_usage() const
+{
+  return sizeof(*this) + m_addr.capacity() * sizeof(uintptr_t) +
+         (m_file.capacity() + m_line.capacity() + m_column.capacity()) * sizeof(uint32_t) +
+         m_files.capacity() * sizeof(std::string_view) + m_sequences.capacity() * sizeof(range);
+}
+
+bool line_cache::find(uintptr_t pc, const line_table*& table) const
+{
+  std::shared_lock<std::shared_mutex> guard(m_lock);
+  auto it = m_by_addr.upper_bound(pc);
+  if(it == m_by_addr.begin() || pc >= (--it)->second.hi)
+    return false;
+  table = it->second.table;
+  return true;
+}
+
+const line_table* line_cache::cu_table(uint64_t cu) const
+{
+  std::shared_lock<std::shared_mutex> guard(m_lock);
+  auto it = m_cus.find(cu);
+  return it != m_cus.end() ? it->second : nullptr;
+}
+
+const line_table* line_cache::insert(uint64_t cu, std::unique_ptr<line_table> table)
+{
+  std::unique_lock<std::shared_mutex> guard(m_lock);
+  auto [it, inserted] = m_cus.emplace(cu, table.get());
+  if(!inserted)
+    return it->second;
+
+  for(const line_table::range& r : table->sequences())
+    add_range(r.lo, r.hi, table.get());
+
+  m_tables.push_back(std::move(table));
+  return m_tables.back().get();
+}
+
+void line_cache::insert_range(uintptr_t lo, uintptr_t hi, const line_table* table)
+{
+  if(lo >= hi)
+    return;
+  std::unique_lock<std::shared_mutex> guard(m_lock);
+  add_range(lo, hi, table ? table : &m_no_lines);
+}
+
+void line_cache::add_range(uintptr_t lo, uintptr_t hi, const line_table* table)
+{
+  // Start at the segment containing lo, if any.
+  auto it = m_by_addr.upper_bound(lo);
+  if(it != m_by_addr.begin() && std::prev(it)->second.hi > lo)
+    --it;
+
+  // Replace the overlapped segments: gaps go to table, overlaps with another table become ambiguous,
+  // and the parts of the segments outside [lo, hi) are kept.
+  std::vector<std::pair<uintptr_t, entry>> pieces;
+  uintptr_t pos = lo;
+  while(it != m_by_addr.end() && it->first < hi)
+  {
+    const uintptr_t seg_lo = it->first;
+    const entry seg = it->second;
+    if(seg_lo < lo)
+      pieces.push_back({ seg_lo, { lo, seg.table } });
+    if(pos < seg_lo)
+      pieces.push_back({ pos, { seg_lo, table } });
+    pieces.push_back({ std::max(seg_lo, lo), { std::min(seg.hi, hi), seg.table == table ? table : nullptr } });
+    if(seg.hi > hi)
+      pieces.push_back({ hi, { seg.hi, seg.table } });
+    pos = std::min(seg.hi, hi);
+    it = m_by_addr.erase(it);
+  }
+  if(pos < hi)
+    pieces.push_back({ pos, { hi, table } });
+
+  // Join touching pieces of one table, so that ranges added over a table's own sequences, such as
+  // its CU's, do not leave the map any longer than it was.
+  size_t kept = 0;
+  for(size_t i = 0; i < pieces.size(); ++i)
+  {
+    if(kept > 0 && pieces[kept - 1].second.hi == pieces[i].first && pieces[kept - 1].second.table &&
+       pieces[kept - 1].second.table == pieces[i].second.table)
+      pieces[kept - 1].second.hi = pieces[i].second.hi;
+    else
+      pieces[kept++] = pieces[i];
+  }
+  pieces.resize(kept);
+
+  m_by_addr.insert(pieces.begin(), pieces.end());
+}
+
+size_t line_cache::memory_usage() const
+{
+  std::shared_lock<std::shared_mutex> guard(m_lock);
+  size_t bytes = m_by_addr.size() * (sizeof(std::pair<const uintptr_t, entry>) + 4 * sizeof(void*));
+  for(const auto& t : m_tables)
+    bytes += t->memory_usage();
+  return bytes;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// The line program of one CU, flattened into sorted arrays that are searched instead of going through
+// dwfl_module_getsrc and dwfl_lineinfo. Rows sharing an address are reduced to the last one, which is
+// the row libdw returns. File names are resolved once per file when the table is built, with the
+// basename and DW_AT_comp_dir options already applied.
+class line_table
+{
+public:
+  struct line
+  {
+    std::string_view file;
+    uint32_t line = 0;
+    uint32_t column = 0;
+  };
+
+  // Building. Rows must be added in address order.
+  uint32_t add_file(std::string_view name);
+  void add_row(uintptr_t addr, uint32_t file, uint32_t line, uint32_t column);
+  void add_end_sequence(uintptr_t addr);
+
+  // Row covering pc: the last row at or below pc, unless that ends a sequence.
+  bool find(uintptr_t pc, line& l) const;
+
+  struct range
+  {
+    uintptr_t lo;
+    uintptr_t hi;
+  };
+
+  // Address ranges of the sequences, from their first row up to their end.
+  const std::vector<range>& sequences() const { return m_sequences; }
+
+  // Limit the sequences to the parts inside ranges, the address ranges of the CU. libdw chooses the
+  // CU of an address by them, so padding between functions that a sequence spans has no line.
+  void clip_sequences(std::vector<range> ranges);
+
+  size_t memory_usage() const;
+
+private:
+  static constexpr uint32_t end_sequence = uint32_t(-1);
+
+  std::vector<uintptr_t> m_addr;
+  std::vector<uint32_t> m_file; // index into m_files, or end_sequence
+  std::vector<uint32_t> m_line;
+  std::vector<uint32_t> m_column;
+  std::vector<std::string_view> m_files;
+
+  std::vector<range> m_sequences;
+  uintptr_t m_sequence_start = 0;
+  bool m_in_sequence = false;
+};
+
+// Line tables by the address ranges of their sequences, each CU built once on first touch. Tables
+// are immutable once inserted and live as long as the cache. Safe to use from several threads.
+//
+// Sequences of different CUs can overlap: linkers point the line programs of discarded COMDAT copies
+// at the copy they kept. Which CU applies there is libdw's choice, so overlapped ranges are marked
+// ambiguous and the caller asks libdw for the CU, then uses cu_table().
+class line_cache
+{
+public:
+  // Whether pc is in a known sequence. table is its line table, or nullptr if several CUs cover pc.
+  bool find(uintptr_t pc, const line_table*& table) const;
+
+  // Table of the CU at DIE offset cu, if it was inserted.
+  const line_table* cu_table(uint64_t cu) const;
+
+  // Make the sequences of table findable, and return it. If the CU was inserted meanwhile, that
+  // table is returned and this one is dropped.
+  const line_table* insert(uint64_t cu, std::unique_ptr<line_table> table);
+
+  // Make [lo, hi) findable as table, one already inserted, for addresses of its CU outside its
+  // sequences; or with a table without lines if table is nullptr, for addresses outside every CU.
+  // Either way find() answers there without the caller going back to libdw.
+  void insert_range(uintptr_t lo, uintptr_t hi, const line_table* table);
+
+  size_t memory_usage() const;
+
+private:
+  struct entry
+  {
+    uintptr_t hi;
+    const line_table* table; // nullptr where sequences of several CUs overlap
+  };
+
+  void add_range(uintptr_t lo, uintptr_t hi, const line_table* table);
+
+  mutable std::shared_mutex m_lock;
+  std::map<uintptr_t, entry> m_by_addr; // by lo, not overlapping
+  std::unordered_map<uint64_t, const line_table*> m_cus;
+  std::vector<std::unique_ptr<line_table>> m_tables;
+  const line_table m_no_lines; // of the ranges outside every CU
+};
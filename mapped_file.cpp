@@ -0,0 +1,52 @@
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+mapped_file::mapped_file(const std::string& path)
+{
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if(fd < 0)
+    return;
+
+  struct stat st;
+  if(fstat(fd, &st) == 0 && st.st_size > 0)
+  {
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(p != MAP_FAILED)
+    {
+      m_data = static_cast<const char*>(p);
+      m_size = st.st_size;
+    }
+  }
+
+  // The mapping keeps the file alive.
+  close(fd);
+}
+
+mapped_file::~mapped_file()
+{
+  if(m_data)
+    munmap(const_cast<char*>(m_data), m_size);
+}
+
+mapped_file::mapped_file(mapped_file&& other) noexcept
+  : m_data(std::exchange(other.m_data, nullptr))
+  , m_size(std::exchange(other.m_size, 0))
+{
+}
+
+mapped_file& mapped_file::operator=(mapped_file&& other) noexcept
+{
+  if(this != &other)
+  {
+    if(m_data)
+      munmap(const_cast<char*>(m_data), m_size);
+    m_data = std::exchange(other.m_data, nullptr);
+    m_size = std::exchange(other.m_size, 0);
+  }
+  return *this;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Read-only private mapping of a whole file. A default constructed or failed mapping is empty.
+class mapped_file
+{
+public:
+  mapped_file() = default;
+  explicit mapped_file(const std::string& path);
+  ~mapped_file();
+
+  mapped_file(mapped_file&& other) noexcept;
+  mapped_file& operator=(mapped_file&& other) noexcept;
+  mapped_file(const mapped_file&) = delete;
+  mapped_file& operator=(const mapped_file&) = delete;
+
+  const char* data() const { return m_data; }
+  size_t size() const { return m_size; }
+  explicit operator bool() const { return m_data != nullptr; }
+
+private:
+  const char* m_data = nullptr;
+  size_t m_size = 0;
+};
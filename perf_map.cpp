@@ -0,0 +1,230 @@
+#include "perf_map.h"
+
+#include "demangle.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+perf_map::perf_map(const std::string& path, const resolver_options& opts,
+                   std::chrono::microseconds min_refresh_interval)
+  : m_path(path)
+  , m_demangle(opts.demangle)
+  , m_min_refresh_interval(min_refresh_interval)
+  , m_current(std::make_shared<index>(0))
+{
+  m_index.store(m_current, std::memory_order_release);
+  refresh(true);
+}
+
+perf_map::index::index(size_t capacity)
+  : capacity(capacity)
+  , start(new uintptr_t[capacity])
+  , ranges(new range[capacity])
+{
+}
+
+std::string perf_map::path_of(pid_t pid, const std::string& dir)
+{
+  return dir + "/perf-" + std::to_string(pid) + ".map";
+}
+
+size_t perf_map::size() const
+{
+  return m_index.load(std::memory_order_acquire)->count.load(std::memory_order_acquire);
+}
+
+bool perf_map::refresh(bool force)
+{
+  // Never wait for another refresh: its result is what this one would find.
+  std::unique_lock<std::mutex> refreshing(m_refresh_lock, std::try_to_lock);
+  if(!refreshing.owns_lock())
+    return false;
+
+  const auto now = std::chrono::steady_clock::now();
+  if(!force && now - m_last_refresh < m_min_refresh_interval)
+    return false;
+  m_last_refresh = now;
+
+  const int fd = open(m_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if(fd < 0)
+    return false;
+
+  struct stat st;
+  if(fstat(fd, &st) != 0)
+  {
+    close(fd);
+    return false;
+  }
+
+  // A new file under the path, from a new process with the same pid say, or one cut short: start over.
+  bool changed = false;
+  if(st.st_dev != m_dev || st.st_ino != m_inode || uint64_t(st.st_size) < m_offset)
+  {
+    changed = m_offset > 0;
+    m_dev = st.st_dev;
+    m_inode = st.st_ino;
+    m_offset = 0;
+    m_ranges.clear();
+    m_appended = 0;
+    m_overwritten = true;
+  }
+
+  // Read the tail up to the size seen, the JIT may still be writing past it.
+  const size_t size = uint64_t(st.st_size) - m_offset;
+  std::unique_ptr<char[]> chunk(new char[size + 1]);
+  size_t got = 0;
+  while(got < size)
+  {
+    const ssize_t n = pread(fd, chunk.get() + got, size - got, m_offset + got);
+    if(n <= 0)
+      break;
+    got += n;
+  }
+  close(fd);
+  chunk[got] = '\0';
+
+  // A line the JIT has not finished writing is read again by the next refresh.
+  const size_t consumed = parse(chunk.get(), got);
+  m_offset += consumed;
+  if(consumed > 0)
+    m_chunks.push_back(std::move(chunk));
+  if(!changed && consumed == 0)
+    return false;
+
+  publish(m_overwritten);
+  return true;
+}
+
+// Make the ranges read so far visible. Ranges appended past the end go into the room left in the
+// current index; anything else, or too many of them, builds a new one with room to double.
+void perf_map::publish(bool rebuild)
+{
+  const size_t count = m_current->count.load(std::memory_order_relaxed);
+  if(!rebuild && count + m_appended <= m_current->capacity)
+  {
+    size_t i = count;
+    for(auto it = std::prev(m_ranges.end(), m_appended); it != m_ranges.end(); ++it, ++i)
+    {
+      m_current->start[i] = it->first;
+      m_current->ranges[i] = it->second;
+    }
+    m_current->count.store(i, std::memory_order_release);
+  }
+  else
+  {
+    auto next = std::make_shared<index>(std::max<size_t>(2 * m_ranges.size(), 1024));
+    size_t i = 0;
+    for(const auto& [start, r] : m_ranges)
+    {
+      next->start[i] = start;
+      next->ranges[i] = r;
+      ++i;
+    }
+    next->count.store(i, std::memory_order_relaxed);
+    m_current = next;
+    m_index.store(std::move(next), std::memory_order_release);
+  }
+
+  m_appended = 0;
+  m_overwritten = false;
+}
+
+// Index the complete lines of data, ending each name with a NUL. Returns the bytes up to the end of
+// the last line.
+size_t perf_map::parse(char* data, size_t size)
+{
+  size_t pos = 0;
+  while(char* eol = static_cast<char*>(memchr(data + pos, '\n', size - pos)))
+  {
+    // START SIZE name, where the name runs to the end of the line and may hold spaces.
+    const char* line = data + pos;
+    pos = eol - data + 1;
+    *eol = '\0';
+
+    char* endp;
+    const uintptr_t start = strtoull(line, &endp, 16);
+    if(endp == line || *endp != ' ')
+      continue;
+    const char* size_at = endp + 1;
+    const uintptr_t length = strtoull(size_at, &endp, 16);
+    if(endp == size_at || *endp != ' ' || length == 0 || start + length < start)
+      continue;
+
+    char* name = endp + 1;
+    if(eol > name && eol[-1] == '\r')
+      eol[-1] = '\0';
+    insert(start, start + length, m_demangle ? demangle(name, m_names) : std::string_view(name));
+  }
+  return pos;
+}
+
+// Add [start, end), cutting what older ranges have of it. Code is mostly emitted at rising addresses,
+// so a range past the last one is appended without a search.
+void perf_map::insert(uintptr_t start, uintptr_t end, std::string_view name)
+{
+  if(m_ranges.empty() || m_ranges.rbegin()->second.end <= start)
+  {
+    m_ranges.emplace_hint(m_ranges.end(), start, range{ end, start, name });
+    ++m_appended;
+    return;
+  }
+
+  m_overwritten = true;
+
+  auto it = m_ranges.lower_bound(start);
+  if(it != m_ranges.begin())
+  {
+    auto prev = std::prev(it);
+    if(prev->second.end > start)
+    {
+      if(prev->second.end > end)
+        m_ranges.emplace(end, prev->second);
+      prev->second.end = start;
+    }
+  }
+
+  while(it != m_ranges.end() && it->first < end)
+  {
+    if(it->second.end > end)
+      m_ranges.emplace(end, it->second);
+    it = m_ranges.erase(it);
+  }
+
+  m_ranges.emplace(start, range{ end, start, name });
+}
+
+int perf_map::lookup(const index& idx, uintptr_t addr, resolved_frame& frame) const
+{
+  frame = {};
+  frame.address = addr;
+
+  const uintptr_t* const start = idx.start.get();
+  const size_t i = std::upper_bound(start, start + idx.count.load(std::memory_order_acquire), addr) - start;
+  if(i == 0 || addr >= idx.ranges[i - 1].end)
+    return frame.status = 1;
+
+  frame.name = idx.ranges[i - 1].name;
+  frame.offset = addr - idx.ranges[i - 1].symbol;
+  return frame.status = 0;
+}
+
+int perf_map::resolve(uintptr_t addr, resolved_frame& frame, resolve_level)
+{
+  return lookup(*m_index.load(std::memory_order_acquire), addr, frame);
+}
+
+size_t perf_map::resolve_batch(std::span<const uintptr_t> addrs, std::span<resolved_frame> results,
+                               resolve_level)
+{
+  // One index for the whole batch, even if a refresh swaps in the next one meanwhile.
+  const std::shared_ptr<const index> idx = m_index.load(std::memory_order_acquire);
+  const size_t n = std::min(addrs.size(), results.size());
+  size_t failed = 0;
+  for(size_t i = 0; i < n; ++i)
+    failed += lookup(*idx, addrs[i], results[i]) != 0;
+  return failed;
+}
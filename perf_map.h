@@ -0,0 +1,104 @@
+#pragma once
+
+#include "resolver_backend.h"
+#include "string_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <vector>
+
+// Symbols of JIT compiled code from a perf map, the /tmp/perf-PID.map file JITs append a
+// "START SIZE name" line to, in hex, for every piece of code they emit. The pcs of that code are in
+// anonymous memory, outside every ELF file.
+//
+// The file only grows while the JIT runs, so refresh() reads from where the previous one stopped and
+// indexes the new lines alone. Lookups search a sorted array of ranges, the same binary search as the
+// symbols of a binary. The array has room to grow: ranges past the end of the last one, the usual
+// case, are written after the ones readers see and then counted in, without copying the array. Code
+// emitted again at an address replaces what an older line said of that range; that, or running out of
+// room, builds the next array beside the current one and swaps it in. Lookups never wait for the
+// reading or parsing of a refresh, only, briefly, for the swap.
+//
+// Lookups stop at resolve_level::symbols whatever the level asked. Names stay valid for as long as the
+// perf_map lives. All members may be called concurrently.
+class perf_map final : public resolver_backend
+{
+public:
+  // The map is first read by the constructor; a file that does not exist yet is read once it does.
+  perf_map(const std::string& path, const resolver_options& opts,
+           std::chrono::microseconds min_refresh_interval = std::chrono::microseconds(0));
+  perf_map(const perf_map&) = delete;
+  perf_map& operator=(const perf_map&) = delete;
+
+  const char* name() const override { return "perf-map"; }
+
+  // The file of JIT pid in the directory JITs write them to.
+  static std::string path_of(pid_t pid, const std::string& dir = "/tmp");
+
+  int resolve(uintptr_t addr, resolved_frame& frame, resolve_level level) override;
+  size_t resolve_batch(std::span<const uintptr_t> addrs, std::span<resolved_frame> results,
+                       resolve_level level) override;
+
+  // Index the lines appended since the previous refresh, or the whole file again if it was replaced
+  // or truncated. Returns true if the index changed. Does nothing if another thread is refreshing, or
+  // if the previous refresh was less than min_refresh_interval ago, unless force is set.
+  bool refresh(bool force = false);
+
+  // Ranges in the current index.
+  size_t size() const;
+
+private:
+  struct range
+  {
+    uintptr_t end;
+    uintptr_t symbol; // start of the code the line described, of which the range may be a part
+    std::string_view name;
+  };
+
+  // The ranges as separate arrays sorted by start, so the binary search only touches the starts.
+  // Entries from count to capacity are not visible yet: the refresh fills them, then raises count.
+  struct index
+  {
+    explicit index(size_t capacity);
+
+    const size_t capacity;
+    std::unique_ptr<uintptr_t[]> start;
+    std::unique_ptr<range[]> ranges;
+    std::atomic<size_t> count{ 0 };
+  };
+
+  size_t parse(char* data, size_t size);
+  void insert(uintptr_t start, uintptr_t end, std::string_view name);
+  void publish(bool rebuild);
+  int lookup(const index& idx, uintptr_t addr, resolved_frame& frame) const;
+
+  const std::string m_path;
+  const bool m_demangle;
+  const std::chrono::microseconds m_min_refresh_interval;
+  string_pool m_names; // demangled names
+
+  // Everything read from the file, where the names are: lines are cut into C strings in place.
+  std::vector<std::unique_ptr<char[]>> m_chunks;
+
+  std::atomic<std::shared_ptr<const index>> m_index;
+
+  // State of the reader, only touched under m_refresh_lock.
+  std::mutex m_refresh_lock;
+  std::chrono::steady_clock::time_point m_last_refresh;
+  dev_t m_dev = 0;
+  ino_t m_inode = 0;
+  uint64_t m_offset = 0;               // end of the last complete line read
+  std::map<uintptr_t, range> m_ranges; // by start, all the ranges read
+  std::shared_ptr<index> m_current;    // the index published in m_index
+  size_t m_appended = 0;               // ranges past the end of m_current since the last publish
+  bool m_overwritten = false;          // whether a range published in m_current changed since
+};
@@ -0,0 +1,490 @@
+#include "process_resolver.h"
+
+#include "elf_image.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+// Mapping in maps containing pc, or nullptr. A template only because process_resolver::mapping is private.
+template <typename Mapping>
+const Mapping* lookup(const std::vector<Mapping>& maps, uintptr_t pc)
+{
+  auto it = std::upper_bound(maps.begin(), maps.end(), pc, [](uintptr_t a, const Mapping& m) {
+    return a < m.start;
+  });
+  if(it == maps.begin() || pc >= (--it)->end)
+    return nullptr;
+  return &*it;
+}
+
+// A pc of a batch in its binary: (binary, address, position in the batch).
+struct located
+{
+  symbol_resolver* binary;
+  uintptr_t addr;
+  size_t pos;
+};
+
+// Buffers of resolve_batch(), reused by every batch resolved on the same thread.
+struct batch_scratch
+{
+  std::vector<located> located_pcs;
+  std::vector<uintptr_t> addrs;
+  std::vector<resolved_frame> frames;
+};
+
+thread_local batch_scratch t_batch;
+}
+
+process_resolver::process_resolver()
+  : process_resolver(options())
+{
+}
+
+process_resolver::process_resolver(const symbol_resolver::options& opts)
+  : process_resolver(options{ opts })
+{
+}
+
+process_resolver::process_resolver(const options& opts)
+  : m_opts(opts)
+  , m_kernel(opts.kallsyms.empty() ? nullptr : std::make_unique<kernel_symbols>(opts.kallsyms))
+{
+}
+
+symbol_resolver* process_resolver::open_binary(const std::string& path)
+{
+  {
+    std::shared_lock<std::shared_mutex> guard(m_lock);
+    auto it = m_by_path.find(path);
+    if(it != m_by_path.end())
+      return it->second;
+  }
+
+  // The same binary under another path, e.g. in another mount namespace, reuses its resolver. Its
+  // build-id note is enough to tell, which saves opening the file with libdwfl only to drop it.
+  const std::string build_id = elf_image(path).build_id();
+  if(!build_id.empty())
+  {
+    std::unique_lock<std::shared_mutex> guard(m_lock);
+    auto same = m_by_build_id.find(build_id);
+    if(same != m_by_build_id.end())
+      return m_by_path.emplace(path, same->second).first->second;
+  }
+
+  // Open the file without holding the lock, lookups of other processes go on meanwhile.
+  std::unique_ptr<symbol_resolver> binary;
+  try
+  {
+    binary = std::make_unique<symbol_resolver>(path, m_opts.resolver);
+  }
+  catch(const std::runtime_error&)
+  {
+    // Remember the failure, maps of live processes are full of data files.
+    std::unique_lock<std::shared_mutex> guard(m_lock);
+    return m_by_path.emplace(path, nullptr).first->second;
+  }
+
+  std::unique_lock<std::shared_mutex> guard(m_lock);
+  auto it = m_by_path.find(path);
+  if(it != m_by_path.end())
+    return it->second; // opened by another thread meanwhile
+
+  // Or one another thread opened under another path meanwhile.
+  if(!binary->build_id().empty())
+  {
+    auto same = m_by_build_id.find(binary->build_id());
+    if(same != m_by_build_id.end())
+      return m_by_path[path] = same->second;
+    m_by_build_id.emplace(binary->build_id(), binary.get());
+  }
+
+  symbol_resolver* res = binary.get();
+  m_binaries.push_back(std::move(binary));
+  return m_by_path[path] = res;
+}
+
+bool process_resolver::make_mapping(const std::string& path, uintptr_t start, uintptr_t end, uint64_t offset,
+                                    mapping& m)
+{
+  if(start >= end)
+    return false;
+
+  symbol_resolver* binary = open_binary(path);
+  if(!binary)
+    return false;
+
+  // Without a loadable segment at offset, assume the file is laid out as it is linked.
+  uintptr_t linked;
+  if(!binary->file_offset_address(offset, linked))
+    linked = offset;
+
+  m = { start, end, start - linked, binary };
+  return true;
+}
+
+process_resolver::mapping_list::iterator process_resolver::cut(mapping_list& maps, uintptr_t start, uintptr_t end)
+{
+  auto first = std::lower_bound(maps.begin(), maps.end(), start, [](const mapping& m, uintptr_t a) {
+    return m.end <= a;
+  });
+  if(first == maps.end() || first->start >= end)
+    return first;
+
+  // Keep what is left of the overlapped mappings on either side.
+  auto last = first;
+  mapping_list pieces;
+  while(last != maps.end() && last->start < end)
+  {
+    if(last->start < start)
+      pieces.push_back({ last->start, start, last->bias, last->binary });
+    if(last->end > end)
+      pieces.push_back({ end, last->end, last->bias, last->binary });
+    ++last;
+  }
+
+  const bool has_left = !pieces.empty() && pieces.front().start < start;
+  first = maps.erase(first, last);
+  first = maps.insert(first, pieces.begin(), pieces.end());
+  return has_left ? first + 1 : first;
+}
+
+void process_resolver::insert_mapping(mapping_list& maps, const mapping& m)
+{
+  maps.insert(cut(maps, m.start, m.end), m);
+}
+
+int process_resolver::add_mapping(pid_t pid, const std::string& path, uintptr_t start, uintptr_t end,
+                                  uint64_t offset)
+{
+  mapping m;
+  if(!make_mapping(path, start, end, offset, m))
+    return -1;
+
+  std::unique_lock<std::shared_mutex> guard(m_lock);
+  insert_mapping(m_processes[pid], m);
+  return 0;
+}
+
+size_t process_resolver::add_perf_map(pid_t pid, const std::string& path)
+{
+  // Read the file without holding the lock.
+  auto map = std::make_unique<perf_map>(path, m_opts.resolver, m_opts.min_refresh_interval);
+  const size_t ranges = map->size();
+
+  std::unique_lock<std::shared_mutex> guard(m_lock);
+  m_jit[pid] = map.get();
+  m_perf_maps.push_back(std::move(map));
+  return ranges;
+}
+
+void process_resolver::remove_process(pid_t pid)
+{
+  std::unique_lock<std::shared_mutex> guard(m_lock);
+  m_processes.erase(pid);
+  m_live.erase(pid);
+  m_jit.erase(pid);
+}
+
+bool process_resolver::read_maps(pid_t pid, std::vector<maps_entry>& entries)
+{
+  char fname[32];
+  snprintf(fname, sizeof(fname), "/proc/%d/maps", int(pid));
+  FILE* f = fopen(fname, "r");
+  if(!f)
+    return false;
+
+  entries.clear();
+  char* line = nullptr;
+  size_t len = 0;
+  while(getline(&line, &len, f) > 0)
+  {
+    // start-end perms offset dev inode [path]
+    maps_entry e;
+    int path_at = 0;
+    if(sscanf(line, "%" SCNxPTR "-%" SCNxPTR " %*s %" SCNx64 " %*s %" SCNu64 " %n", &e.start, &e.end, &e.offset,
+              &e.inode, &path_at) < 4 || path_at == 0)
+      continue;
+
+    // Only files: anonymous memory, [heap], [vdso] and friends have nothing to symbolize here.
+    const char* path = line + path_at;
+    if(path[0] != '/' || e.inode == 0)
+      continue;
+
+    e.path.assign(path, strcspn(path, "\n"));
+    entries.push_back(std::move(e));
+  }
+
+  free(line);
+  fclose(f);
+  return true;
+}
+
+int process_resolver::attach(pid_t pid)
+{
+  std::shared_ptr<live_process> live = std::make_shared<live_process>();
+  {
+    std::unique_lock<std::shared_mutex> guard(m_lock);
+    m_live[pid] = live;
+  }
+
+  if(!read_maps(pid, live->snapshot))
+  {
+    std::unique_lock<std::shared_mutex> guard(m_lock);
+    m_live.erase(pid);
+    return -1;
+  }
+  live->last_refresh = std::chrono::steady_clock::now();
+
+  for(const maps_entry& e : live->snapshot)
+    add_mapping(pid, e.path, e.start, e.end, e.offset);
+
+  // The JIT may start writing its perf map later; the file is read from the first miss after it does.
+  if(m_opts.perf_maps)
+    add_perf_map(pid, perf_map::path_of(pid, m_opts.perf_map_dir));
+  return 0;
+}
+
+bool process_resolver::refresh(pid_t pid, bool force)
+{
+  std::shared_ptr<live_process> live;
+  {
+    std::shared_lock<std::shared_mutex> guard(m_lock);
+    auto it = m_live.find(pid);
+    if(it == m_live.end())
+      return false;
+    live = it->second;
+  }
+
+  // Never wait for another refresh of the same process: its result is what this one would find.
+  std::unique_lock<std::mutex> refreshing(live->refresh_lock, std::try_to_lock);
+  if(!refreshing.owns_lock())
+    return false;
+
+  const auto now = std::chrono::steady_clock::now();
+  if(!force && now - live->last_refresh < m_opts.min_refresh_interval)
+    return false;
+  live->last_refresh = now;
+
+  // A process that exited keeps its last mappings, samples taken before it went are still resolved.
+  std::vector<maps_entry> current;
+  if(!read_maps(pid, current))
+    return false;
+
+  // Both lists are sorted by start address: merge them into the entries that went away and the ones
+  // that are new. Unchanged entries, normally nearly all of them, cost one comparison.
+  std::vector<const maps_entry*> removed, added;
+  const std::vector<maps_entry>& previous = live->snapshot;
+  size_t i = 0, j = 0;
+  while(i < previous.size() || j < current.size())
+  {
+    if(j == current.size() || (i < previous.size() && previous[i].start < current[j].start))
+      removed.push_back(&previous[i++]);
+    else if(i == previous.size() || current[j].start < previous[i].start)
+      added.push_back(&current[j++]);
+    else if(previous[i] == current[j])
+      ++i, ++j;
+    else
+    {
+      removed.push_back(&previous[i++]);
+      added.push_back(&current[j++]);
+    }
+  }
+
+  if(removed.empty() && added.empty())
+    return false;
+
+  // Open new binaries before taking the lock, lookups go on meanwhile.
+  std::vector<mapping> new_maps;
+  new_maps.reserve(added.size());
+  for(const maps_entry* e : added)
+  {
+    mapping m;
+    if(make_mapping(e->path, e->start, e->end, e->offset, m))
+      new_maps.push_back(m);
+  }
+
+  {
+    std::unique_lock<std::shared_mutex> guard(m_lock);
+    mapping_list& maps = m_processes[pid];
+    for(const maps_entry* e : removed)
+      cut(maps, e->start, e->end);
+    for(const mapping& m : new_maps)
+      insert_mapping(maps, m);
+  }
+
+  live->snapshot = std::move(current);
+  return true;
+}
+
+process_resolver::pc_kind process_resolver::classify(pid_t pid, uintptr_t pc, mapping& m) const
+{
+  std::shared_lock<std::shared_mutex> guard(m_lock);
+  auto proc = m_processes.find(pid);
+  return classify(proc != m_processes.end() ? &proc->second : nullptr, pc, m);
+}
+
+// Sets m if pc is mapped.
+process_resolver::pc_kind process_resolver::classify(const mapping_list* maps, uintptr_t pc, mapping& m) const
+{
+  // Kernel addresses are never in a user mapping.
+  if(m_kernel && m_kernel->contains(pc))
+    return pc_kind::kernel;
+
+  const mapping* found = maps ? lookup(*maps, pc) : nullptr;
+  if(!found)
+    return pc_kind::unmapped;
+
+  m = *found;
+  return pc_kind::mapped;
+}
+
+perf_map* process_resolver::find_perf_map(pid_t pid) const
+{
+  std::shared_lock<std::shared_mutex> guard(m_lock);
+  auto it = m_jit.find(pid);
+  return it != m_jit.end() ? it->second : nullptr;
+}
+
+int process_resolver::resolve(pid_t pid, uintptr_t pc, resolved_frame& frame)
+{
+  return resolve(pid, pc, frame, m_opts.resolver.level);
+}
+
+int process_resolver::resolve(pid_t pid, uintptr_t pc, resolved_frame& frame, resolve_level level)
+{
+  mapping m;
+  pc_kind kind = classify(pid, pc, m);
+  if(kind == pc_kind::kernel)
+    return m_kernel->resolve(pc, frame, level);
+
+  if(kind == pc_kind::unmapped)
+  {
+    perf_map* jit = find_perf_map(pid);
+    if(jit && jit->resolve(pc, frame, level) == 0)
+      return 0;
+
+    // New code of either kind: read what changed in the maps, then in the perf map.
+    if(refresh(pid))
+      kind = classify(pid, pc, m);
+    if(kind == pc_kind::unmapped)
+    {
+      if(jit && jit->refresh() && jit->resolve(pc, frame, level) == 0)
+        return 0;
+      frame = {};
+      frame.address = pc;
+      return frame.status = 1;
+    }
+  }
+
+  const int res = m.binary->resolve(pc - m.bias, frame, level);
+  frame.address = pc;
+  return res;
+}
+
+size_t process_resolver::resolve_batch(pid_t pid, std::span<const uintptr_t> pcs, std::span<resolved_frame> results)
+{
+  return resolve_batch(pid, pcs, results, m_opts.resolver.level);
+}
+
+size_t process_resolver::resolve_batch(pid_t pid, std::span<const uintptr_t> pcs, std::span<resolved_frame> results,
+                                       resolve_level level)
+{
+  const size_t n = std::min(pcs.size(), results.size());
+
+  // (binary, position) of every pc, grouped by binary.
+  std::vector<located>& located_pcs = t_batch.located_pcs;
+  located_pcs.reserve(n);
+
+  size_t failed = 0;
+  for(bool refreshed = false;; refreshed = true)
+  {
+    located_pcs.clear();
+    failed = 0;
+
+    std::shared_lock<std::shared_mutex> guard(m_lock);
+    auto proc = m_processes.find(pid);
+    const mapping_list* maps = proc != m_processes.end() ? &proc->second : nullptr;
+    auto jit_it = m_jit.find(pid);
+    perf_map* jit = jit_it != m_jit.end() ? jit_it->second : nullptr;
+    for(size_t i = 0; i < n; ++i)
+    {
+      mapping m;
+      switch(classify(maps, pcs[i], m))
+      {
+      case pc_kind::kernel:
+        failed += m_kernel->resolve(pcs[i], results[i], level) != 0;
+        break;
+      case pc_kind::mapped:
+        located_pcs.push_back({ m.binary, pcs[i] - m.bias, i });
+        break;
+      case pc_kind::unmapped:
+        if(jit && jit->resolve(pcs[i], results[i], level) == 0)
+          break;
+        results[i] = {};
+        results[i].address = pcs[i];
+        ++failed;
+        break;
+      }
+    }
+    guard.unlock();
+
+    // Give an attached process, and the perf map, one refresh for the whole batch.
+    if(!failed || refreshed)
+      break;
+    const bool remapped = refresh(pid);
+    const bool jitted = jit && jit->refresh();
+    if(!remapped && !jitted)
+      break;
+  }
+
+  std::sort(located_pcs.begin(), located_pcs.end(), [](const located& a, const located& b) {
+    return a.binary != b.binary ? a.binary < b.binary : a.pos < b.pos;
+  });
+
+  std::vector<uintptr_t>& addrs = t_batch.addrs;
+  std::vector<resolved_frame>& frames = t_batch.frames;
+  for(size_t lo = 0, hi; lo < located_pcs.size(); lo = hi)
+  {
+    for(hi = lo; hi < located_pcs.size() && located_pcs[hi].binary == located_pcs[lo].binary; ++hi)
+      ;
+
+    addrs.clear();
+    for(size_t k = lo; k < hi; ++k)
+      addrs.push_back(located_pcs[k].addr);
+    frames.resize(addrs.size());
+
+    failed += located_pcs[lo].binary->resolve_batch(addrs, frames, level);
+
+    for(size_t k = lo; k < hi; ++k)
+    {
+      resolved_frame& f = results[located_pcs[k].pos];
+      f = frames[k - lo];
+      f.address = pcs[located_pcs[k].pos];
+    }
+  }
+
+  return failed;
+}
+
+size_t process_resolver::binary_count() const
+{
+  std::shared_lock<std::shared_mutex> guard(m_lock);
+  return m_binaries.size();
+}
+
+std::vector<resolver_stats> process_resolver::stats() const
+{
+  std::shared_lock<std::shared_mutex> guard(m_lock);
+  std::vector<resolver_stats> stats;
+  stats.reserve(m_binaries.size());
+  for(const auto& binary : m_binaries)
+    stats.push_back(binary->stats());
+  return stats;
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include "kernel_symbols.h"
+#include "perf_map.h"
+#include "symbol_resolver.h"
+
+#include <sys/types.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Resolves runtime addresses of any number of processes. Each process is described by its file
+// mappings; a pc is looked up in the mappings of its pid, moved by the mapping's load bias to the
+// address the binary was linked at, and resolved by the symbol_resolver of that binary.
+//
+// There is one symbol_resolver per distinct binary, shared by every process that maps it: files are
+// opened once per path, and paths with the same build-id share the first resolver opened for it, so
+// memory and startup cost follow the number of binaries rather than the number of processes.
+// Resolvers are kept until the process_resolver is destroyed, so the views in the returned frames stay
+// valid even after the process that produced them has been removed.
+//
+// A live process can be attached instead of described by hand: its mappings are read from
+// /proc/PID/maps, and when a pc of the process misses every mapping the file is read again and only
+// the entries that changed since the previous read are applied.
+//
+// pcs outside every file mapping, in code a JIT emitted, are looked up in the perf map of the process
+// if it has one: /tmp/perf-PID.map for an attached process, or a file given to add_perf_map(). A miss
+// there reads the lines the JIT appended since, along with the refresh of the maps. Perf maps are kept
+// like the binaries, so the names of JIT frames also outlive their process.
+//
+// Kernel pcs, which stacks taken in system calls and interrupts start with, are resolved from the
+// kallsyms file given in the options, shared by every process.
+//
+// All members may be called concurrently.
+class process_resolver
+{
+public:
+  struct options
+  {
+    symbol_resolver::options resolver; // for every binary
+    // Minimum time between two refreshes of an attached process, so that a burst of misses in
+    // unmapped memory (JIT code, say) does not reread its maps on every sample.
+    std::chrono::microseconds min_refresh_interval{ 1000 };
+    bool perf_maps = true;             // look up JIT code of attached processes in their perf map
+    std::string perf_map_dir = "/tmp"; // where JITs write perf-PID.map
+    std::string kallsyms{};            // if not empty, /proc/kallsyms or a copy, for kernel pcs
+  };
+
+  // Throws std::runtime_error if the kallsyms file of the options cannot be read.
+  process_resolver();
+  explicit process_resolver(const symbol_resolver::options& opts);
+  explicit process_resolver(const options& opts);
+  process_resolver(const process_resolver&) = delete;
+  process_resolver& operator=(const process_resolver&) = delete;
+
+  // Register that pid maps path at [start, end), starting from file offset. A mapping replaces the
+  // parts of older mappings of pid it overlaps, like mmap does. Returns 0, or -1 if path cannot be
+  // opened as an ELF file, in which case addresses in the range stay unresolved.
+  int add_mapping(pid_t pid, const std::string& path, uintptr_t start, uintptr_t end, uint64_t offset);
+
+  // Look up the pcs of pid that are in no file mapping in the perf map at path, e.g. a copy saved with
+  // a recording. Replaces the perf map pid had. Returns the number of code ranges in the map, 0 if it
+  // is empty or does not exist yet.
+  size_t add_perf_map(pid_t pid, const std::string& path);
+
+  // Forget the mappings of pid, and stop refreshing them if it was attached.
+  void remove_process(pid_t pid);
+
+  // Register the file mappings of the running process pid from /proc/PID/maps and keep them up to
+  // date on misses. Returns 0, or -1 if the maps cannot be read.
+  int attach(pid_t pid);
+
+  // Reread the maps of an attached process and apply what changed. Returns true if any mapping was
+  // added or removed. Does nothing if another thread is refreshing pid, or if the previous refresh
+  // was less than min_refresh_interval ago, unless force is set.
+  bool refresh(pid_t pid, bool force = false);
+
+  // Same results as symbol_resolver::resolve(); frame.address is the runtime pc. Returns 1 if pc is
+  // neither in a mapping of pid nor in its perf map, after refreshing both.
+  int resolve(pid_t pid, uintptr_t pc, resolved_frame& frame);
+  int resolve(pid_t pid, uintptr_t pc, resolved_frame& frame, resolve_level level);
+
+  // Resolve many pcs of one process. The pcs are grouped by binary and each group goes through
+  // symbol_resolver::resolve_batch(). Returns the number of pcs that failed to resolve.
+  size_t resolve_batch(pid_t pid, std::span<const uintptr_t> pcs, std::span<resolved_frame> results);
+  size_t resolve_batch(pid_t pid, std::span<const uintptr_t> pcs, std::span<resolved_frame> results,
+                       resolve_level level);
+
+  // Number of distinct binaries opened so far.
+  size_t binary_count() const;
+
+  // symbol_resolver::stats() of every binary opened so far, in the order they were opened.
+  std::vector<resolver_stats> stats() const;
+
+private:
+  struct mapping
+  {
+    uintptr_t start;
+    uintptr_t end;
+    uintptr_t bias; // runtime address - link-time address
+    symbol_resolver* binary;
+  };
+
+  // Sorted, non-overlapping mappings of one process.
+  using mapping_list = std::vector<mapping>;
+
+  // One line of /proc/PID/maps.
+  struct maps_entry
+  {
+    uintptr_t start;
+    uintptr_t end;
+    uint64_t offset;
+    uint64_t inode;
+    std::string path;
+
+    bool operator==(const maps_entry&) const = default;
+  };
+
+  // Where a pc is resolved from. resolve() and resolve_batch() classify pcs the same way: kernel pcs
+  // first, as they are never in a user mapping, then mapped ones; only unmapped pcs go to the perf map.
+  enum class pc_kind
+  {
+    kernel,
+    mapped,
+    unmapped,
+  };
+
+  // The last /proc/PID/maps read of an attached process.
+  struct live_process
+  {
+    std::mutex refresh_lock; // held while reading and diffing
+    std::vector<maps_entry> snapshot;
+    std::chrono::steady_clock::time_point last_refresh;
+  };
+
+  symbol_resolver* open_binary(const std::string& path);
+  bool make_mapping(const std::string& path, uintptr_t start, uintptr_t end, uint64_t offset, mapping& m);
+  static void insert_mapping(mapping_list& maps, const mapping& m);
+  static mapping_list::iterator cut(mapping_list& maps, uintptr_t start, uintptr_t end);
+  static bool read_maps(pid_t pid, std::vector<maps_entry>& entries);
+  pc_kind classify(pid_t pid, uintptr_t pc, mapping& m) const;
+  pc_kind classify(const mapping_list* maps, uintptr_t pc, mapping& m) const; // maps under m_lock
+  perf_map* find_perf_map(pid_t pid) const;
+
+  const options m_opts;
+  const std::unique_ptr<kernel_symbols> m_kernel; // immutable, searched without m_lock
+
+  mutable std::shared_mutex m_lock;
+  std::vector<std::unique_ptr<symbol_resolver>> m_binaries;
+  std::unordered_map<std::string, symbol_resolver*> m_by_path; // nullptr if not an ELF file
+  std::unordered_map<std::string, symbol_resolver*> m_by_build_id;
+  std::unordered_map<pid_t, mapping_list> m_processes;
+  std::unordered_map<pid_t, std::shared_ptr<live_process>> m_live;
+  std::vector<std::unique_ptr<perf_map>> m_perf_maps; // every one added, for the names they hold
+  std::unordered_map<pid_t, perf_map*> m_jit;
+};
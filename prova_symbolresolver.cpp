@@ -1,13 +1,433 @@
+// Resolve addresses of one ELF file:
+//
+//   prova_symbolresolver file address...
+//   prova_symbolresolver [-b] [-f fd] [-l symbols|lines|inlines] [-i] [-s] [-B batch] file
+//
+// With addresses on the command line, prints the symbol starting at each of them. Without, streams:
+// addresses are read from stdin, or from fd with -f, until end of input, as whitespace separated hex
+// text (0x optional) or with -b as packed little-endian 64-bit values. Every address gives exactly one
+// line on stdout, in input order, so the program can be kept running as a co-process:
+//
+//   0xADDR <tab> NAME+0xOFFSET <tab> FILE:LINE [<tab> FUNCTION at FILE:LINE]...
+//
+// where unknown parts are ??, and the trailing fields are the inline chain with -i, innermost first.
+// Text that is not an address gives a line of ?? in its place.
+//
+// Reading, resolving and writing run on their own threads over a few recycled batches, so one batch
+// is read while the previous one is resolved and the one before it written. A batch holds whatever one
+// read() returned, so addresses trickling in are answered at once and a full pipe is taken in large
+// batches. Output goes to fd 1 with write(2), a whole batch at a time, without stdio locking.
+
 #include "symbol_resolver.h"
+
+#include <endian.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
 #include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+struct batch
+{
+  std::vector<uintptr_t> addrs;
+  std::vector<uint8_t> valid; // per address, 0 for text that did not parse
+  std::vector<resolved_frame> frames;
+  std::string out;
+};
+
+// Bounded hand-off of batches from one pipeline stage to the next.
+class channel
+{
+public:
+  void push(batch* b)
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_items.push_back(b);
+    m_cond.notify_one();
+  }
+
+  // Next batch, or nullptr once the channel is closed and drained.
+  batch* pop()
+  {
+    std::unique_lock<std::mutex> guard(m_lock);
+    m_cond.wait(guard, [this] { return !m_items.empty() || m_closed; });
+    if(m_items.empty())
+      return nullptr;
+    batch* b = m_items.front();
+    m_items.pop_front();
+    return b;
+  }
+
+  void close()
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_closed = true;
+    m_cond.notify_all();
+  }
+
+private:
+  std::mutex m_lock;
+  std::condition_variable m_cond;
+  std::deque<batch*> m_items;
+  bool m_closed = false;
+};
+
+struct settings
+{
+  int fd = 0;
+  bool binary = false;
+  bool show_inlines = false;
+  resolve_level level = resolve_level::lines;
+  size_t max_batch = 4096;
+};
+
+int hex_digit(char c)
+{
+  if(c >= '0' && c <= '9')
+    return c - '0';
+  if(c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if(c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+bool is_space(char c)
+{
+  return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+}
+
+void add_token(batch& b, std::string_view token)
+{
+  if(token.size() > 2 && token[0] == '0' && (token[1] == 'x' || token[1] == 'X'))
+    token.remove_prefix(2);
+
+  uintptr_t addr = 0;
+  bool ok = !token.empty() && token.size() <= 2 * sizeof(uintptr_t);
+  for(size_t i = 0; ok && i < token.size(); ++i)
+  {
+    const int d = hex_digit(token[i]);
+    ok = d >= 0;
+    addr = addr << 4 | d;
+  }
+
+  b.addrs.push_back(ok ? addr : 0);
+  b.valid.push_back(ok);
+}
+
+// Read input into batches until end of input. Text tokens and binary values split by a read() carry
+// over to the next batch.
+void read_input(const settings& s, channel& free_batches, channel& to_resolve)
+{
+  const size_t chunk = s.max_batch * (s.binary ? sizeof(uint64_t) : 8);
+  std::vector<char> buf(chunk);
+  std::string carry;
+
+  for(;;)
+  {
+    ssize_t n = read(s.fd, buf.data(), buf.size());
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n < 0)
+      perror("read");
+    if(n <= 0)
+      break;
+
+    batch* b = free_batches.pop();
+    b->addrs.clear();
+    b->valid.clear();
+
+    if(s.binary)
+    {
+      size_t pos = 0;
+      if(!carry.empty())
+      {
+        pos = std::min(sizeof(uint64_t) - carry.size(), size_t(n));
+        carry.append(buf.data(), pos);
+        if(carry.size() == sizeof(uint64_t))
+        {
+          uint64_t v;
+          memcpy(&v, carry.data(), sizeof(v));
+          b->addrs.push_back(le64toh(v));
+          b->valid.push_back(true);
+          carry.clear();
+        }
+      }
+      for(; pos + sizeof(uint64_t) <= size_t(n); pos += sizeof(uint64_t))
+      {
+        uint64_t v;
+        memcpy(&v, buf.data() + pos, sizeof(v));
+        b->addrs.push_back(le64toh(v));
+        b->valid.push_back(true);
+      }
+      carry.append(buf.data() + pos, n - pos);
+    }
+    else
+    {
+      const char* p = buf.data();
+      const char* end = p + n;
+      // Finish the token cut by the previous read.
+      if(!carry.empty())
+      {
+        while(p < end && !is_space(*p))
+          carry += *p++;
+        if(p == end)
+        {
+          free_batches.push(b);
+          continue;
+        }
+        add_token(*b, carry);
+        carry.clear();
+      }
+      while(p < end)
+      {
+        while(p < end && is_space(*p))
+          ++p;
+        const char* token = p;
+        while(p < end && !is_space(*p))
+          ++p;
+        if(p == end)
+          carry.assign(token, p); // may continue in the next read
+        else
+          add_token(*b, std::string_view(token, p - token));
+      }
+    }
+
+    if(b->addrs.empty())
+      free_batches.push(b);
+    else
+      to_resolve.push(b);
+  }
+
+  // A last token without a newline after it.
+  if(!s.binary && !carry.empty())
+  {
+    batch* b = free_batches.pop();
+    b->addrs.clear();
+    b->valid.clear();
+    add_token(*b, carry);
+    to_resolve.push(b);
+  }
+  else if(s.binary && !carry.empty())
+    fprintf(stderr, "ignoring %zu trailing bytes\n", carry.size());
+
+  to_resolve.close();
+}
+
+void append_hex(std::string& out, uintptr_t v)
+{
+  char buf[2 + 2 * sizeof(v)] = { '0', 'x' };
+  const auto r = std::to_chars(buf + 2, buf + sizeof(buf), v, 16);
+  out.append(buf, r.ptr);
+}
+
+void append_dec(std::string& out, uint32_t v)
+{
+  char buf[16];
+  const auto r = std::to_chars(buf, buf + sizeof(buf), v);
+  out.append(buf, r.ptr);
+}
+
+void append_location(std::string& out, std::string_view file, uint32_t line)
+{
+  out += file.empty() ? std::string_view("??") : file;
+  out += ':';
+  append_dec(out, line);
+}
+
+void format(batch& b, bool show_inlines)
+{
+  b.out.clear();
+  for(size_t i = 0; i < b.addrs.size(); ++i)
+  {
+    const resolved_frame& f = b.frames[i];
+    if(!b.valid[i])
+    {
+      b.out += "??\t??\t??:0\n";
+      continue;
+    }
+
+    append_hex(b.out, b.addrs[i]);
+    b.out += '\t';
+    if(f.name.empty())
+      b.out += "??";
+    else
+    {
+      b.out += f.name;
+      b.out += '+';
+      append_hex(b.out, f.offset);
+    }
+    b.out += '\t';
+    append_location(b.out, f.file, f.line);
+
+    if(show_inlines)
+      for(const inline_frame& in : f.inlines)
+      {
+        b.out += '\t';
+        b.out += in.function.empty() ? std::string_view("??") : in.function;
+        b.out += " at ";
+        append_location(b.out, in.call_file, in.call_line);
+      }
+    b.out += '\n';
+  }
+}
+
+void resolve_input(symbol_resolver& resolver, const settings& s, channel& to_resolve, channel& to_write)
+{
+  while(batch* b = to_resolve.pop())
+  {
+    if(b->frames.size() < b->addrs.size())
+      b->frames.resize(b->addrs.size());
+    resolver.resolve_batch(b->addrs, b->frames, s.level);
+    format(*b, s.show_inlines);
+    to_write.push(b);
+  }
+  to_write.close();
+}
+
+// Returns false once stdout cannot be written, after which batches are only recycled.
+bool write_all(const std::string& out)
+{
+  for(size_t pos = 0; pos < out.size();)
+  {
+    const ssize_t n = write(1, out.data() + pos, out.size() - pos);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0)
+    {
+      perror("write");
+      return false;
+    }
+    pos += n;
+  }
+  return true;
+}
+
+int stream(symbol_resolver& resolver, const settings& s)
+{
+  // Enough batches for every stage to have one in hand and one queued.
+  std::vector<batch> batches(6);
+  channel free_batches, to_resolve, to_write;
+  for(batch& b : batches)
+    free_batches.push(&b);
+
+  int status = 0;
+  std::thread reader(read_input, std::cref(s), std::ref(free_batches), std::ref(to_resolve));
+  std::thread writer([&] {
+    bool ok = true;
+    while(batch* b = to_write.pop())
+    {
+      ok = ok && write_all(b->out);
+      free_batches.push(b);
+    }
+    if(!ok)
+      status = 1;
+  });
+
+  resolve_input(resolver, s, to_resolve, to_write);
+  reader.join();
+  writer.join();
+  return status;
+}
+
+// A whole option argument as a decimal number of type T.
+template <typename T>
+bool parse_option(const char* str, T& value)
+{
+  const char* end = str + strlen(str);
+  const auto [ptr, ec] = std::from_chars(str, end, value);
+  return ec == std::errc() && ptr == end;
+}
+
+int usage(const char* argv0)
+{
+  fprintf(stderr,
+          "usage: %s file address...\n"
+          "       %s [-b] [-f fd] [-l symbols|lines|inlines] [-i] [-s] [-B batch] file\n",
+          argv0, argv0);
+  return 2;
+}
+}
 
 int main(int argc, char* argv[])
 {
-  std::cout << "filename: " << argv[1] << '\n';
+  settings s;
+  symbol_resolver::options opts;
+
+  int opt;
+  while((opt = getopt(argc, argv, "bf:l:isB:")) != -1)
+  {
+    switch(opt)
+    {
+    case 'b':
+      s.binary = true;
+      break;
+    case 'f':
+      if(!parse_option(optarg, s.fd) || s.fd < 0)
+        return usage(argv[0]);
+      break;
+    case 'l':
+      if(strcmp(optarg, "symbols") == 0)
+        s.level = resolve_level::symbols;
+      else if(strcmp(optarg, "lines") == 0)
+        s.level = resolve_level::lines;
+      else if(strcmp(optarg, "inlines") == 0)
+        s.level = resolve_level::inlines;
+      else
+        return usage(argv[0]);
+      break;
+    case 'i':
+      s.show_inlines = opts.show_inlines = true;
+      s.level = resolve_level::inlines;
+      break;
+    case 's':
+      opts.only_basenames = true;
+      break;
+    case 'B':
+      if(!parse_option(optarg, s.max_batch))
+        return usage(argv[0]);
+      break;
+    default:
+      return usage(argv[0]);
+    }
+  }
+  if(optind >= argc || s.max_batch == 0)
+    return usage(argv[0]);
+
+  // Nothing after the file: streaming mode.
+  if(optind + 1 == argc)
+  {
+    opts.symbols_only = s.level == resolve_level::symbols;
+    try
+    {
+      symbol_resolver R(argv[optind], opts);
+      return stream(R, s);
+    }
+    catch(const std::exception& e)
+    {
+      fprintf(stderr, "%s\n", e.what());
+      return 1;
+    }
+  }
+
+  std::cout << "filename: " << argv[optind] << '\n';
 
-  symbol_resolver R(argv[1]);
+  symbol_resolver R(argv[optind]);
 
-  for(int i = 2; i < argc; ++i) {
+  // Like addr2line, go on past an address that does not resolve, and report it in the exit status.
+  int status = 0;
+  for(int i = optind + 1; i < argc; ++i) {
     uintptr_t addr = std::stoul(argv[i], nullptr, 16);
 
     std::string symbol;
@@ -16,8 +436,8 @@ int main(int argc, char* argv[])
     std::cout << "  " << (void*)addr << " - " << symbol << '\n';
 
     if(res != 0)
-      return res;
+      status = res;
   }
 
-  return 0;
+  return status;
 }
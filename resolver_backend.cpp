@@ -0,0 +1,31 @@
+#include "resolver_backend.h"
+
+#include "kernel_symbols.h"
+#include "symbol_resolver.h"
+#ifdef HAVE_LIBBACKTRACE
+#include "backtrace_resolver.h"
+#endif
+
+#include <stdexcept>
+
+std::unique_ptr<resolver_backend> make_backend(backend_kind kind, const std::string& fname,
+                                               const resolver_options& opts)
+{
+  switch(kind)
+  {
+  case backend_kind::elfutils:
+    return std::make_unique<symbol_resolver>(fname, opts);
+
+  case backend_kind::libbacktrace:
+#ifdef HAVE_LIBBACKTRACE
+    return std::make_unique<backtrace_resolver>(fname, opts);
+#else
+    throw std::runtime_error("built without libbacktrace");
+#endif
+
+  case backend_kind::kallsyms:
+    return std::make_unique<kernel_symbols>(fname);
+  }
+
+  throw std::runtime_error("unknown backend");
+}
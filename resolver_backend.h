@@ -0,0 +1,97 @@
+#pragma once
+
+#include "inline_table.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+
+class debug_file_cache;
+
+// How much of an address is resolved. Each level adds to the one before; DWARF is only read from the
+// lines level on, so resolving at the symbols level never opens or parses the .debug_* sections.
+enum class resolve_level
+{
+  symbols, // ELF symbol or section: name, offset and section
+  lines,   // and source file, line and column
+  inlines, // and DWARF function names, inline depth, and with show_inlines the inline chain
+};
+
+// Everything the resolver knows about one address. The string views point into names owned by the
+// resolver that produced the frame and stay valid for as long as that resolver lives.
+struct resolved_frame
+{
+  uintptr_t address = 0;
+  std::string_view name;     // demangled symbol name, or the DWARF function name if there is no symbol
+  uintptr_t offset = 0;      // address - start of the symbol, or of the section if name is empty
+  std::string_view file;     // source file, honouring the basename / comp_dir options
+  uint32_t line = 0;
+  uint32_t column = 0;
+  std::string_view section;  // section the address falls in
+  uint32_t inline_depth = 0; // number of inlined subroutines the address is nested in
+  std::span<const inline_frame> inlines; // with show_inlines: those subroutines, innermost first
+  int status = 1;            // same meaning as the return value of resolve()
+};
+
+// Per-instance settings, formerly the addr2line command line options. Backends other than elfutils
+// honour the ones that apply to them.
+struct resolver_options
+{
+  bool only_basenames = false;      // Show only base names of source files (-s).
+  bool use_comp_dir = false;        // Show absolute file names based on DW_AT_comp_dir (-A).
+  bool show_functions = true;       // Determine function names from DWARF.
+  bool show_symbols = true;         // Determine ELF symbol or section info.
+  bool show_symbol_sections = true; // Determine the section associated with a symbol address.
+  std::string just_section;         // If not empty, take addresses as relative to this section (-j).
+  bool show_inlines = false;        // Walk all inlined subroutines of the address (-i).
+  bool demangle = true;             // Demangle C++ names.
+  bool demangle_ahead = false;      // Demangle a module's whole symbol table when its index is built.
+  size_t cache_entries = 16384;     // Bound of the per-function result cache, 0 disables it.
+  std::string index_dir;            // If not empty, symbol indexes are saved here by build-id and
+                                    // mapped by later runs instead of being rebuilt. Line
+                                    // and inline tables are not saved.
+  resolve_level level = resolve_level::inlines; // Level of lookups that do not give one.
+  bool symbols_only = false;        // Read the symbol table straight from a mapping of the file,
+                                    // without libdwfl. Lookups stop at resolve_level::symbols.
+  unsigned stats_sample_period = 64; // Time one lookup in this many for stats(), rounded up to a
+                                     // power of two; 0 only counts.
+  unsigned prewarm_threads = 0;     // If not 0, index symbols, line tables and inline tables of every
+                                    // module on this many background threads from construction on.
+  std::string debug_dirs;           // ':'-separated directories searched for separate debug files,
+                                    // before the default ones, by build-id and .gnu_debuglink.
+  std::shared_ptr<debug_file_cache> debug_cache; // If set, debug files with compressed sections are
+                                                 // decompressed once per build-id and shared by
+                                                 // every resolver given the same cache.
+};
+
+// One way of resolving the addresses of an ELF file. symbol_resolver does it with elfutils and
+// backtrace_resolver with libbacktrace; code that only needs frames can take either through this
+// interface and pick the backend that is faster for its workload.
+class resolver_backend
+{
+public:
+  virtual ~resolver_backend() = default;
+
+  // Short name of the implementation, for reports.
+  virtual const char* name() const = 0;
+
+  // Same contract as symbol_resolver::resolve() and resolve_batch() with an explicit level.
+  virtual int resolve(uintptr_t addr, resolved_frame& frame, resolve_level level) = 0;
+  virtual size_t resolve_batch(std::span<const uintptr_t> addrs, std::span<resolved_frame> results,
+                               resolve_level level) = 0;
+};
+
+enum class backend_kind
+{
+  elfutils,
+  libbacktrace,
+  kallsyms, // fname is /proc/kallsyms or a copy of it, see kernel_symbols
+};
+
+// Open fname with the given backend. Throws std::runtime_error if the file cannot be opened, or if
+// the backend was not compiled in.
+std::unique_ptr<resolver_backend> make_backend(backend_kind kind, const std::string& fname,
+                                               const resolver_options& opts);
@@ -0,0 +1,217 @@
+#include "resolver_service.h"
+
+#include <algorithm>
+
+resolver_service::resolver_service(process_resolver& resolver)
+  : resolver_service(resolver, options())
+{
+}
+
+resolver_service::resolver_service(process_resolver& resolver, const options& opts)
+  : m_resolver(resolver)
+  , m_opts(opts)
+{
+  size_t workers = m_opts.workers ? m_opts.workers : std::thread::hardware_concurrency();
+  workers = std::max<size_t>(workers, 1);
+
+  m_queues.reset(new worker_queue[workers]);
+  m_workers.reserve(workers);
+  for(size_t i = 0; i < workers; ++i)
+    m_workers.emplace_back(&resolver_service::run, this, i);
+}
+
+resolver_service::~resolver_service()
+{
+  {
+    std::lock_guard<std::mutex> guard(m_wake_lock);
+    m_stop = true;
+  }
+  m_wake.notify_all();
+
+  for(std::thread& t : m_workers)
+    t.join();
+}
+
+bool resolver_service::submit(pid_t pid, std::vector<uintptr_t> pcs, callback done)
+{
+  const size_t n = pcs.size();
+  if(n == 0)
+  {
+    done(result());
+    return true;
+  }
+
+  // Reserve room for the pcs, or give up without waiting.
+  size_t pending = m_pending.load(std::memory_order_relaxed);
+  do
+  {
+    if(n > m_opts.max_pending - std::min(pending, m_opts.max_pending))
+    {
+      m_rejected.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+  }
+  while(!m_pending.compare_exchange_weak(pending, pending + n, std::memory_order_relaxed));
+
+  const size_t chunk = std::max<size_t>(m_opts.chunk, 1);
+  const size_t chunks = (n + chunk - 1) / chunk;
+
+  auto req = std::make_shared<request>();
+  req->pid = pid;
+  req->pcs = std::move(pcs);
+  req->res.frames.resize(n);
+  req->remaining.store(chunks, std::memory_order_relaxed);
+  req->done = std::move(done);
+  m_submitted.fetch_add(1, std::memory_order_relaxed);
+
+  // Count the chunks before they are visible, so that a worker taking one never sees m_queued wrap.
+  // A worker woken early finds nothing and waits again until the chunk is pushed.
+  {
+    std::lock_guard<std::mutex> guard(m_wake_lock);
+    m_queued.fetch_add(chunks, std::memory_order_relaxed);
+  }
+
+  // Deal the chunks out over the queues, starting where the previous request stopped.
+  const size_t nqueues = m_workers.size();
+  size_t q = m_next_queue.fetch_add(chunks, std::memory_order_relaxed);
+  for(size_t lo = 0; lo < n; lo += chunk, ++q)
+  {
+    worker_queue& wq = m_queues[q % nqueues];
+    std::lock_guard<std::mutex> guard(wq.lock);
+    wq.tasks.push_back({ req, lo, std::min(n, lo + chunk) });
+  }
+
+  if(chunks == 1)
+    m_wake.notify_one();
+  else
+    m_wake.notify_all();
+  return true;
+}
+
+std::future<resolver_service::result> resolver_service::submit(pid_t pid, std::vector<uintptr_t> pcs)
+{
+  auto promise = std::make_shared<std::promise<result>>();
+  std::future<result> future = promise->get_future();
+  auto done = [promise](result&& res) {
+    if(res.error)
+      promise->set_exception(res.error);
+    else
+      promise->set_value(std::move(res));
+  };
+  if(!submit(pid, std::move(pcs), std::move(done)))
+    promise->set_exception(std::make_exception_ptr(queue_full()));
+  return future;
+}
+
+void resolver_service::drain()
+{
+  std::unique_lock<std::mutex> guard(m_wake_lock);
+  m_idle.wait(guard, [this] { return m_pending.load(std::memory_order_acquire) == 0; });
+}
+
+resolver_service::stats resolver_service::get_stats() const
+{
+  stats s;
+  s.submitted = m_submitted.load(std::memory_order_relaxed);
+  s.completed = m_completed.load(std::memory_order_relaxed);
+  s.rejected = m_rejected.load(std::memory_order_relaxed);
+  s.stolen = m_stolen.load(std::memory_order_relaxed);
+  s.pending = m_pending.load(std::memory_order_relaxed);
+  return s;
+}
+
+void resolver_service::run(size_t self)
+{
+  for(;;)
+  {
+    task t;
+    if(take(self, t))
+    {
+      execute(t);
+      continue;
+    }
+
+    std::unique_lock<std::mutex> guard(m_wake_lock);
+    m_wake.wait(guard, [this] { return m_stop || m_queued.load(std::memory_order_relaxed) > 0; });
+    if(m_stop && m_queued.load(std::memory_order_relaxed) == 0)
+      return;
+  }
+}
+
+// The newest chunk of our own queue, whose request is most likely still warm in the caches, or else
+// the oldest chunk of another worker.
+bool resolver_service::take(size_t self, task& t)
+{
+  const size_t nqueues = m_workers.size();
+  for(size_t i = 0; i < nqueues; ++i)
+  {
+    worker_queue& wq = m_queues[(self + i) % nqueues];
+    std::lock_guard<std::mutex> guard(wq.lock);
+    if(wq.tasks.empty())
+      continue;
+
+    if(i == 0)
+    {
+      t = std::move(wq.tasks.back());
+      wq.tasks.pop_back();
+    }
+    else
+    {
+      t = std::move(wq.tasks.front());
+      wq.tasks.pop_front();
+      m_stolen.fetch_add(1, std::memory_order_relaxed);
+    }
+    m_queued.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  return false;
+}
+
+void resolver_service::execute(const task& t)
+{
+  request& req = *t.req;
+  const size_t n = t.hi - t.lo;
+  const std::span<resolved_frame> frames = std::span<resolved_frame>(req.res.frames).subspan(t.lo, n);
+  size_t failed;
+  try
+  {
+    failed = m_resolver.resolve_batch(req.pid, std::span<const uintptr_t>(req.pcs).subspan(t.lo, n), frames,
+                                      m_opts.level);
+  }
+  catch(...)
+  {
+    // The chunk counts as failed, whatever the lookup left in its frames; the other chunks go on.
+    for(size_t i = 0; i < n; ++i)
+    {
+      frames[i] = {};
+      frames[i].address = req.pcs[t.lo + i];
+    }
+    failed = n;
+
+    std::lock_guard<std::mutex> guard(req.error_lock);
+    if(!req.res.error)
+      req.res.error = std::current_exception();
+  }
+  req.failed.fetch_add(failed, std::memory_order_relaxed);
+
+  if(req.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+  {
+    req.res.failed = req.failed.load(std::memory_order_relaxed);
+    try
+    {
+      req.done(std::move(req.res));
+    }
+    catch(...)
+    {
+      // Nobody to report it to; the worker and the bookkeeping below must go on.
+    }
+    m_completed.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  if(m_pending.fetch_sub(n, std::memory_order_acq_rel) == n)
+  {
+    std::lock_guard<std::mutex> guard(m_wake_lock);
+    m_idle.notify_all();
+  }
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "process_resolver.h"
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+// Asynchronous front end of a process_resolver: callers submit the pcs of a process and get the frames
+// later through a future or a callback, while a pool of worker threads does the lookups. The workers
+// share the process_resolver, so every binary is opened and indexed once no matter which worker
+// meets it first.
+//
+// Submitting never blocks on lookups. Requests are cut into chunks that are spread over per-worker
+// queues; a worker that runs out of chunks steals from the others, so a burst keeps every core busy.
+// The pcs queued or being resolved are bounded by max_pending: a request that would go over it is
+// rejected at once instead of waiting, so a flood of samples in binaries that still have to be parsed
+// cannot hold up the threads producing them.
+//
+// The frames point into the process_resolver, which must outlive the results. All members may be
+// called concurrently.
+class resolver_service
+{
+public:
+  struct options
+  {
+    size_t workers = 0;               // worker threads, 0 for one per hardware thread
+    size_t max_pending = 1 << 20;     // pcs queued or in progress; more are rejected
+    size_t chunk = 256;               // pcs per unit of work, the granularity of stealing
+    resolve_level level = resolve_level::inlines;
+  };
+
+  struct result
+  {
+    std::vector<resolved_frame> frames; // frames[i] is the resolution of pcs[i]
+    size_t failed = 0;                  // pcs that did not resolve
+    std::exception_ptr error;           // first exception a lookup threw; its chunk counts as failed
+  };
+
+  // Runs on a worker thread when the last chunk of a request is done, or at once in submit() for an
+  // empty request. Should not throw: an exception it throws is dropped.
+  using callback = std::function<void(result&&)>;
+
+  // The exception held by the future of a rejected request.
+  class queue_full : public std::runtime_error
+  {
+  public:
+    queue_full() : std::runtime_error("resolver queue is full") {}
+  };
+
+  struct stats
+  {
+    uint64_t submitted = 0; // requests accepted
+    uint64_t completed = 0; // requests done
+    uint64_t rejected = 0;  // requests refused because the queue was full
+    uint64_t stolen = 0;    // chunks run by another worker than the one they were queued on
+    size_t pending = 0;     // pcs queued or in progress
+  };
+
+  explicit resolver_service(process_resolver& resolver);
+  resolver_service(process_resolver& resolver, const options& opts);
+  resolver_service(const resolver_service&) = delete;
+  resolver_service& operator=(const resolver_service&) = delete;
+
+  // Finishes the requests already accepted, then stops the workers.
+  ~resolver_service();
+
+  // Queue the pcs of pid. Returns false, without calling done, if the queue has no room for them.
+  bool submit(pid_t pid, std::vector<uintptr_t> pcs, callback done);
+
+  // Same, with the result delivered through a future. A rejected request gives a future holding
+  // queue_full, one whose lookup threw a future holding that exception.
+  std::future<result> submit(pid_t pid, std::vector<uintptr_t> pcs);
+
+  // Wait until every request accepted so far is done.
+  void drain();
+
+  stats get_stats() const;
+
+private:
+  struct request
+  {
+    pid_t pid;
+    std::vector<uintptr_t> pcs;
+    result res;
+    std::atomic<size_t> remaining; // chunks not done yet
+    std::atomic<size_t> failed{ 0 };
+    std::mutex error_lock; // guards res.error
+    callback done;
+  };
+
+  struct task
+  {
+    std::shared_ptr<request> req;
+    size_t lo;
+    size_t hi;
+  };
+
+  struct alignas(64) worker_queue
+  {
+    std::mutex lock;
+    std::deque<task> tasks;
+  };
+
+  void run(size_t self);
+  bool take(size_t self, task& t);
+  void execute(const task& t);
+
+  process_resolver& m_resolver;
+  const options m_opts;
+
+  std::unique_ptr<worker_queue[]> m_queues; // one per worker
+  std::vector<std::thread> m_workers;
+  std::atomic<size_t> m_next_queue{ 0 }; // round robin over m_queues for new chunks
+
+  // Idle workers sleep here; m_queued counts the chunks in all queues.
+  std::mutex m_wake_lock;
+  std::condition_variable m_wake;
+  std::atomic<size_t> m_queued{ 0 };
+  bool m_stop = false;
+
+  std::condition_variable m_idle; // signalled under m_wake_lock when m_pending drops to 0
+  std::atomic<size_t> m_pending{ 0 };
+
+  std::atomic<uint64_t> m_submitted{ 0 };
+  std::atomic<uint64_t> m_completed{ 0 };
+  std::atomic<uint64_t> m_rejected{ 0 };
+  std::atomic<uint64_t> m_stolen{ 0 };
+};
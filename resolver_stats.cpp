@@ -0,0 +1,133 @@
+#include "resolver_stats.h"
+
+#include <algorithm>
+#include <bit>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+const char* stage_name(resolver_stage stage)
+{
+  switch(stage)
+  {
+  case resolver_stage::parse:
+    return "parse";
+  case resolver_stage::module:
+    return "module";
+  case resolver_stage::symbol:
+    return "symbol";
+  case resolver_stage::demangle:
+    return "demangle";
+  case resolver_stage::scopes:
+    return "scopes";
+  case resolver_stage::lines:
+    return "lines";
+  case resolver_stage::inlines:
+    return "inlines";
+  case resolver_stage::total:
+    return "total";
+  }
+  return "?";
+}
+
+uint64_t stage_stats::percentile(double q) const
+{
+  if(timed == 0)
+    return 0;
+
+  const uint64_t rank = std::min<uint64_t>(timed - 1, uint64_t(timed * q));
+  uint64_t seen = 0;
+  for(size_t b = 0; b < buckets; ++b)
+  {
+    seen += histogram[b];
+    if(seen > rank)
+      return b == 0 ? 0 : (uint64_t(1) << b) - 1;
+  }
+  return uint64_t(1) << (buckets - 1);
+}
+
+#if SYMBOL_RESOLVER_STATS
+
+stage_recorder::stage_recorder(unsigned sample_period)
+  : m_sample_mask(sample_period ? std::bit_ceil(sample_period) - 1 : ~0u)
+  , m_nslots(std::max<size_t>(std::thread::hardware_concurrency(), 16))
+  , m_slots(new slot_counters[m_nslots])
+  , m_timings(new timings[resolver_stage_count])
+{
+}
+
+namespace
+{
+// Thread numbers given back by exited threads; the lowest is handed out first.
+std::mutex g_numbers_lock;
+std::vector<size_t> g_free_numbers; // heap ordered by std::greater
+size_t g_next_number = 0;
+
+struct thread_number_holder
+{
+  size_t number;
+
+  ~thread_number_holder()
+  {
+    std::lock_guard<std::mutex> guard(g_numbers_lock);
+    g_free_numbers.push_back(number);
+    std::push_heap(g_free_numbers.begin(), g_free_numbers.end(), std::greater<size_t>());
+  }
+};
+}
+
+size_t stage_recorder::acquire_thread_number()
+{
+  size_t number;
+  {
+    std::lock_guard<std::mutex> guard(g_numbers_lock);
+    if(g_free_numbers.empty())
+      number = g_next_number++;
+    else
+    {
+      std::pop_heap(g_free_numbers.begin(), g_free_numbers.end(), std::greater<size_t>());
+      number = g_free_numbers.back();
+      g_free_numbers.pop_back();
+    }
+  }
+
+  // The lock orders the counts of the thread that held the number before the ones of this thread.
+  thread_local thread_number_holder t_holder{ number };
+  return number;
+}
+
+void stage_recorder::record(resolver_stage stage, uint64_t ns)
+{
+  timings& t = m_timings[size_t(stage)];
+  const size_t bucket = std::min<size_t>(std::bit_width(ns), stage_stats::buckets - 1);
+  t.timed.fetch_add(1, std::memory_order_relaxed);
+  t.total_ns.fetch_add(ns, std::memory_order_relaxed);
+  t.histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+void stage_recorder::snapshot(resolver_stats& stats) const
+{
+  stats.enabled = true;
+  stats.sample_period = m_sample_mask == ~0u ? 0 : m_sample_mask + 1;
+
+  for(size_t s = 0; s < resolver_stage_count; ++s)
+  {
+    stage_stats& out = stats.stages[s];
+    out = {};
+    for(size_t i = 0; i <= m_nslots; ++i)
+    {
+      const counters& c = i < m_nslots ? m_slots[i].stages[s] : m_overflow.stages[s];
+      out.calls += c.calls.load(std::memory_order_relaxed);
+      out.misses += c.misses.load(std::memory_order_relaxed);
+    }
+
+    const timings& t = m_timings[s];
+    out.timed = t.timed.load(std::memory_order_relaxed);
+    out.total_ns = t.total_ns.load(std::memory_order_relaxed);
+    for(size_t b = 0; b < stage_stats::buckets; ++b)
+      out.histogram[b] = t.histogram[b].load(std::memory_order_relaxed);
+  }
+}
+
+#endif
@@ -0,0 +1,217 @@
+#pragma once
+
+#include "frame_cache.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Counters and latency histograms of the stages of a lookup. Built in unless SYMBOL_RESOLVER_STATS is
+// defined to 0, in which case the recorders are empty and every call into them compiles away; stats()
+// then only reports the cache and memory figures.
+#ifndef SYMBOL_RESOLVER_STATS
+#define SYMBOL_RESOLVER_STATS 1
+#endif
+
+// The stages nest: demangling runs inside the symbol and inline stages, scopes inside inlines, and
+// total covers a whole lookup, so their times overlap. What counts as a miss is given per stage.
+enum class resolver_stage
+{
+  parse,    // address text to address, in resolve(const char*)
+  module,   // module search when an address leaves the cursor's module; miss: index built or loaded
+  symbol,   // symbol of an address on a frame cache miss; miss: the index was searched
+  demangle, // demangled name of a symbol or DWARF function; miss: demangled now, and always timed
+  scopes,   // scope chain of the innermost DIE; miss: dwarf_getscopes was called
+  lines,    // row of the address in its CU line table; miss: the table was built
+  inlines,  // inline chain of the address; miss: the function's inline table was built
+  total,    // a whole lookup; miss: the frame cache missed
+};
+
+constexpr size_t resolver_stage_count = size_t(resolver_stage::total) + 1;
+
+const char* stage_name(resolver_stage stage);
+
+struct stage_stats
+{
+  // Bucket b holds latencies in [2^(b-1), 2^b) ns, bucket 0 those of 0 ns; the last bucket is open.
+  static constexpr size_t buckets = 32;
+
+  uint64_t calls = 0;    // times the stage ran
+  uint64_t misses = 0;   // of those, times it did the slow work, see resolver_stage
+  uint64_t timed = 0;    // calls that were timed, those of one lookup in sample_period
+  uint64_t total_ns = 0; // over the timed calls
+  uint64_t histogram[buckets] = {};
+
+  double mean_ns() const { return timed ? double(total_ns) / timed : 0; }
+
+  // Upper bound of the bucket holding fraction q of the timed calls, 0 if none was timed.
+  uint64_t percentile(double q) const;
+};
+
+struct resolver_stats
+{
+  bool enabled = false;       // built with SYMBOL_RESOLVER_STATS; otherwise stages are all zero
+  unsigned sample_period = 0; // one lookup in this many is timed, 0 if none is
+  stage_stats stages[resolver_stage_count]; // indexed by resolver_stage
+
+  frame_cache::stats cache;
+  size_t line_table_bytes = 0;   // flattened CU line tables
+  size_t inline_table_bytes = 0; // flattened function inline tables
+  size_t name_bytes = 0;         // demangled and composed names, outside the symbol indexes
+
+  struct module
+  {
+    std::string file;
+    uintptr_t lo = 0;
+    uintptr_t hi = 0;
+    bool indexed = false;       // the symbol index was built or loaded
+    bool mapped = false;        // the index is a saved one mapped from index_dir
+    size_t symbols = 0;
+    size_t index_bytes = 0;     // symbol tables and their name tables
+    size_t demangle_bytes = 0;  // demangled names of the module's symbols
+  };
+  std::vector<module> modules;
+
+  const stage_stats& operator[](resolver_stage stage) const { return stages[size_t(stage)]; }
+};
+
+#if SYMBOL_RESOLVER_STATS
+
+// Records the stages of one resolver. Each thread counts its calls in a slot of its own, with a relaxed
+// load and store on a cache line no other thread writes; threads beyond the number of slots, at least
+// one per hardware thread, share an overflow slot with atomic adds. Latencies are only taken for one
+// lookup in sample_period, which keeps the clock reads off most lookups, and go to shared histograms.
+class stage_recorder
+{
+public:
+  explicit stage_recorder(unsigned sample_period);
+
+  // Whether the lookup that starts now is timed.
+  bool sample() const
+  {
+    thread_local unsigned t_tick = 0;
+    return m_sample_mask != ~0u && (++t_tick & m_sample_mask) == 0;
+  }
+
+  void count(resolver_stage stage, bool miss = false)
+  {
+    const size_t n = thread_number();
+    if(n < m_nslots)
+    {
+      // Only this thread writes its slot, so no locked add is needed; snapshot() may read it meanwhile.
+      counters& c = m_slots[n].stages[size_t(stage)];
+      c.calls.store(c.calls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      if(miss)
+        c.misses.store(c.misses.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    else
+    {
+      counters& c = m_overflow.stages[size_t(stage)];
+      c.calls.fetch_add(1, std::memory_order_relaxed);
+      if(miss)
+        c.misses.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  void record(resolver_stage stage, uint64_t ns);
+
+  void snapshot(resolver_stats& stats) const;
+
+private:
+  struct counters
+  {
+    std::atomic<uint64_t> calls{ 0 };
+    std::atomic<uint64_t> misses{ 0 };
+  };
+
+  struct alignas(64) slot_counters
+  {
+    counters stages[resolver_stage_count];
+  };
+
+  struct timings
+  {
+    std::atomic<uint64_t> timed{ 0 };
+    std::atomic<uint64_t> total_ns{ 0 };
+    std::atomic<uint64_t> histogram[stage_stats::buckets] = {};
+  };
+
+  // Number of the calling thread, the lowest one not held by a running thread, so numbers stay below
+  // the number of threads alive at once and each slot has one writer at a time.
+  static size_t thread_number()
+  {
+    // Constant initialized, so reading it needs no TLS guard; 0 until the thread is given a number.
+    thread_local size_t t_number = 0;
+    if(t_number == 0)
+      t_number = acquire_thread_number() + 1;
+    return t_number - 1;
+  }
+
+  // Hands out a number and gives it back when the thread exits.
+  static size_t acquire_thread_number();
+
+  unsigned m_sample_mask; // sample_period - 1, or ~0u if nothing is timed
+  size_t m_nslots;
+  std::unique_ptr<slot_counters[]> m_slots; // indexed by thread number
+  slot_counters m_overflow;                 // threads numbered m_nslots and above
+  std::unique_ptr<timings[]> m_timings; // one per stage
+};
+
+// Times one stage from construction to destruction, if timed, and counts it in any case.
+class stage_timer
+{
+public:
+  stage_timer(stage_recorder& recorder, resolver_stage stage, bool timed)
+    : m_recorder(recorder)
+    , m_stage(stage)
+    , m_timed(timed)
+  {
+    if(m_timed)
+      m_start = std::chrono::steady_clock::now();
+  }
+
+  ~stage_timer()
+  {
+    m_recorder.count(m_stage, m_miss);
+    if(m_timed)
+      m_recorder.record(m_stage, std::chrono::nanoseconds(std::chrono::steady_clock::now() - m_start).count());
+  }
+
+  stage_timer(const stage_timer&) = delete;
+  stage_timer& operator=(const stage_timer&) = delete;
+
+  // The stage is doing its slow work this time.
+  void miss() { m_miss = true; }
+
+private:
+  stage_recorder& m_recorder;
+  resolver_stage m_stage;
+  bool m_timed;
+  bool m_miss = false;
+  std::chrono::steady_clock::time_point m_start;
+};
+
+#else
+
+class stage_recorder
+{
+public:
+  explicit stage_recorder(unsigned) {}
+  bool sample() const { return false; }
+  void count(resolver_stage, bool = false) {}
+  void record(resolver_stage, uint64_t) {}
+  void snapshot(resolver_stats&) const {}
+};
+
+class stage_timer
+{
+public:
+  stage_timer(stage_recorder&, resolver_stage, bool) {}
+  void miss() {}
+};
+
+#endif
@@ -0,0 +1,353 @@
+#include "stack_profile.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <string_view>
+
+namespace
+{
+const std::string_view unknown_function = "[unknown]";
+
+// Append a function name to a folded line, where ';' separates the frames and a newline the stacks.
+void append_folded(std::string& line, std::string_view name)
+{
+  if(name.empty())
+    name = unknown_function;
+  for(char c : name)
+    line += c == ';' ? ':' : c == '\n' ? ' ' : c;
+}
+
+void append_varint(std::string& out, uint64_t v)
+{
+  for(; v >= 0x80; v >>= 7)
+    out += char(v | 0x80);
+  out += char(v);
+}
+
+// Just enough of the protobuf wire format to write profile.proto.
+class proto_message
+{
+public:
+  // A varint field, left out when 0 like proto3 does.
+  void add(int field, uint64_t value)
+  {
+    if(value == 0)
+      return;
+    append_varint(m_data, uint64_t(field) << 3);
+    append_varint(m_data, value);
+  }
+
+  void add(int field, std::string_view bytes)
+  {
+    append_varint(m_data, uint64_t(field) << 3 | 2);
+    append_varint(m_data, bytes.size());
+    m_data.append(bytes);
+  }
+
+  void add(int field, const proto_message& message) { add(field, std::string_view(message.m_data)); }
+
+  void add_packed(int field, std::span<const uint64_t> values)
+  {
+    std::string packed;
+    for(uint64_t v : values)
+      append_varint(packed, v);
+    add(field, std::string_view(packed));
+  }
+
+  void clear() { m_data.clear(); }
+  const std::string& data() const { return m_data; }
+
+private:
+  std::string m_data;
+};
+
+// The string_table of a profile, where index 0 is the empty string. The views must outlive the table.
+class string_table
+{
+public:
+  string_table() { id(std::string_view()); }
+
+  uint64_t id(std::string_view s)
+  {
+    auto [it, inserted] = m_ids.emplace(s, m_strings.size());
+    if(inserted)
+      m_strings.push_back(s);
+    return it->second;
+  }
+
+  const std::vector<std::string_view>& strings() const { return m_strings; }
+
+private:
+  std::unordered_map<std::string_view, uint64_t> m_ids;
+  std::vector<std::string_view> m_strings;
+};
+}
+
+stack_profile::stack_profile(symbol_resolver& resolver)
+  : stack_profile(resolver, options())
+{
+}
+
+stack_profile::stack_profile(symbol_resolver& resolver, const options& opts)
+  : m_resolver(resolver)
+  , m_opts(opts)
+{
+}
+
+uintptr_t stack_profile::lookup_address(std::span<const uintptr_t> stack, size_t i) const
+{
+  return i > 0 && m_opts.return_addresses && stack[i] > 0 ? stack[i] - 1 : stack[i];
+}
+
+size_t stack_profile::hash(std::span<const uintptr_t> stack) const
+{
+  uint64_t h = stack.size();
+  for(size_t i = 0; i < stack.size(); ++i)
+    h = (h ^ lookup_address(stack, i)) * 0x9e3779b97f4a7c15ull;
+  return h ^ (h >> 32);
+}
+
+bool stack_profile::same(const stack_entry& s, std::span<const uintptr_t> stack) const
+{
+  if(s.depth != stack.size())
+    return false;
+  for(size_t i = 0; i < stack.size(); ++i)
+    if(m_addrs[m_stack_frames[s.first + i]] != lookup_address(stack, i))
+      return false;
+  return true;
+}
+
+// Double the slots, keeping them at most half full.
+void stack_profile::grow()
+{
+  m_slots.assign(std::max<size_t>(64, 2 * m_slots.size()), 0);
+  const size_t mask = m_slots.size() - 1;
+  for(size_t s = 0; s < m_stacks.size(); ++s)
+  {
+    size_t i = m_stacks[s].hash & mask;
+    while(m_slots[i] != 0)
+      i = (i + 1) & mask;
+    m_slots[i] = s + 1;
+  }
+}
+
+uint32_t stack_profile::intern_frame(uintptr_t addr)
+{
+  auto [it, inserted] = m_frame_ids.emplace(addr, m_addrs.size());
+  if(inserted)
+    m_addrs.push_back(addr);
+  return it->second;
+}
+
+void stack_profile::add(std::span<const uintptr_t> stack, uint64_t count)
+{
+  if(stack.empty())
+    return;
+  m_samples += count;
+
+  if(2 * (m_stacks.size() + 1) > m_slots.size())
+    grow();
+
+  const size_t h = hash(stack);
+  const size_t mask = m_slots.size() - 1;
+  size_t i = h & mask;
+  for(; m_slots[i] != 0; i = (i + 1) & mask)
+  {
+    stack_entry& s = m_stacks[m_slots[i] - 1];
+    if(s.hash == h && same(s, stack))
+    {
+      s.count += count;
+      return;
+    }
+  }
+
+  // A new stack: only now are its pcs looked up among the frames.
+  const stack_entry s{ uint32_t(m_stack_frames.size()), uint32_t(stack.size()), h, count };
+  for(size_t k = 0; k < stack.size(); ++k)
+    m_stack_frames.push_back(intern_frame(lookup_address(stack, k)));
+  m_stacks.push_back(s);
+  m_slots[i] = m_stacks.size();
+}
+
+void stack_profile::add(std::span<const std::span<const uintptr_t>> stacks)
+{
+  for(std::span<const uintptr_t> stack : stacks)
+    add(stack);
+}
+
+void stack_profile::clear(bool release_frames)
+{
+  m_samples = 0;
+  if(!release_frames)
+  {
+    m_stacks.clear();
+    m_stack_frames.clear();
+    std::fill(m_slots.begin(), m_slots.end(), 0);
+    return;
+  }
+
+  m_stacks = {};
+  m_stack_frames = {};
+  m_slots = {};
+  m_addrs = {};
+  m_frames = {};
+  m_frame_ids = {};
+  m_resolved = 0;
+}
+
+// Resolve the frames added since the last call, all in one batch.
+void stack_profile::resolve()
+{
+  if(m_resolved == m_addrs.size())
+    return;
+
+  const size_t n = m_addrs.size() - m_resolved;
+  m_frames.resize(m_addrs.size());
+  m_resolver.resolve_batch(std::span<const uintptr_t>(m_addrs).subspan(m_resolved, n),
+                           std::span<resolved_frame>(m_frames).subspan(m_resolved, n), m_opts.level);
+  m_resolved = m_addrs.size();
+}
+
+void stack_profile::write_folded(std::ostream& out)
+{
+  resolve();
+
+  std::string line;
+  for(const stack_entry& s : m_stacks)
+  {
+    line.clear();
+    for(size_t k = s.depth; k-- > 0;)
+    {
+      const resolved_frame& f = m_frames[m_stack_frames[s.first + k]];
+      if(!line.empty())
+        line += ';';
+      append_folded(line, f.name);
+      for(size_t j = f.inlines.size(); j-- > 0;)
+      {
+        line += ';';
+        append_folded(line, f.inlines[j].function);
+      }
+    }
+
+    char count[24];
+    const auto r = std::to_chars(count, count + sizeof(count), s.count);
+    line += ' ';
+    line.append(count, r.ptr);
+    line += '\n';
+    out.write(line.data(), line.size());
+  }
+}
+
+void stack_profile::write_pprof(std::ostream& out)
+{
+  resolve();
+
+  // Field numbers are those of profile.proto in github.com/google/pprof.
+  string_table strings;
+  proto_message profile, message, line;
+
+  message.add(1, strings.id(m_opts.sample_type)); // ValueType.type
+  message.add(2, strings.id(m_opts.sample_unit)); // ValueType.unit
+  profile.add(1, message);                        // Profile.sample_type
+
+  std::string build_id;
+  const uint64_t mapping_id = m_opts.binary.empty() ? 0 : 1;
+  if(mapping_id)
+  {
+    for(unsigned char c : m_resolver.build_id())
+    {
+      char hex[3];
+      snprintf(hex, sizeof(hex), "%02x", c);
+      build_id += hex;
+    }
+
+    const auto [lo, hi] = std::minmax_element(m_addrs.begin(), m_addrs.end());
+    message.clear();
+    message.add(1, mapping_id);                              // Mapping.id
+    message.add(2, lo != m_addrs.end() ? *lo : 0);           // memory_start
+    message.add(3, hi != m_addrs.end() ? *hi + 1 : 0);       // memory_limit
+    message.add(5, strings.id(m_opts.binary));               // filename
+    message.add(6, strings.id(build_id));                    // build_id
+    message.add(7, 1);                                       // has_functions
+    message.add(8, m_opts.level >= resolve_level::lines);    // has_filenames
+    message.add(9, m_opts.level >= resolve_level::lines);    // has_line_numbers
+    message.add(10, m_opts.level >= resolve_level::inlines); // has_inline_frames
+    profile.add(3, message);                                 // Profile.mapping
+  }
+
+  // Functions by (name, file) string ids, written on first use.
+  std::unordered_map<uint64_t, uint64_t> function_ids;
+  auto function_id = [&](std::string_view name, std::string_view file) {
+    const uint64_t name_id = strings.id(name.empty() ? unknown_function : name);
+    const uint64_t file_id = strings.id(file);
+    auto [it, inserted] = function_ids.emplace(name_id << 32 | file_id, function_ids.size() + 1);
+    if(inserted)
+    {
+      proto_message function;
+      function.add(1, it->second); // Function.id
+      function.add(2, name_id);    // name
+      function.add(3, name_id);    // system_name
+      function.add(4, file_id);    // filename
+      profile.add(5, function);    // Profile.function
+    }
+    return it->second;
+  };
+
+  auto add_line = [&](proto_message& location, uint64_t function, uint32_t lineno, uint32_t column) {
+    line.clear();
+    line.add(1, function); // Line.function_id
+    line.add(2, lineno);   // line
+    line.add(3, column);   // column
+    location.add(4, line); // Location.line
+  };
+
+  // Locations, one per frame a stack uses, written on first use. Their lines go from the innermost
+  // inlined function out to the function the code is in, each at the call site in the next one.
+  std::vector<uint64_t> location_ids(m_addrs.size(), 0);
+  uint64_t next_location = 1;
+  auto location_id = [&](uint32_t frame) {
+    if(location_ids[frame])
+      return location_ids[frame];
+
+    const resolved_frame& f = m_frames[frame];
+    proto_message location;
+    location.add(1, next_location);  // Location.id
+    location.add(2, mapping_id);     // mapping_id
+    location.add(3, m_addrs[frame]); // address
+    if(!f.name.empty() || !f.file.empty() || !f.inlines.empty())
+    {
+      std::string_view file = f.file;
+      uint32_t lineno = f.line;
+      uint32_t column = f.column;
+      for(const inline_frame& in : f.inlines)
+      {
+        add_line(location, function_id(in.function, file), lineno, column);
+        file = in.call_file;
+        lineno = in.call_line;
+        column = in.call_column;
+      }
+      add_line(location, function_id(f.name, file), lineno, column);
+    }
+    profile.add(4, location); // Profile.location
+    return location_ids[frame] = next_location++;
+  };
+
+  std::vector<uint64_t> ids;
+  for(const stack_entry& s : m_stacks)
+  {
+    ids.clear();
+    for(size_t k = 0; k < s.depth; ++k)
+      ids.push_back(location_id(m_stack_frames[s.first + k]));
+
+    message.clear();
+    message.add_packed(1, ids);                                    // Sample.location_id, leaf first
+    message.add_packed(2, std::span<const uint64_t>(&s.count, 1)); // value
+    profile.add(2, message);                                       // Profile.sample
+  }
+
+  for(std::string_view s : strings.strings())
+    profile.add(6, s); // Profile.string_table
+
+  out.write(profile.data().data(), profile.data().size());
+}
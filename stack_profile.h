@@ -0,0 +1,91 @@
+#pragma once
+
+#include "symbol_resolver.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Aggregates whole call stacks of one binary into a profile. Stacks are interned: one seen before only
+// costs hashing and comparing its pcs, and only the pcs of new stacks are looked up among the known
+// frames. Every distinct pc is resolved once, by one resolve_batch() over the frames added since the
+// last output, so the resolver's work grows with the distinct frames and not with the samples. The
+// profile is written as folded stacks for flame graphs or as a pprof profile.proto, with counts.
+//
+// Stacks list their pcs leaf first, the way unwinders give them. With return_addresses every pc above
+// the leaf is a return address and is looked up one byte earlier, inside the call, so that its line
+// and inline chain are those of the call site. Inlined functions become frames of their own when the
+// resolver was opened with show_inlines.
+//
+// Not safe for concurrent use; the resolver may be shared with other users.
+class stack_profile
+{
+public:
+  struct options
+  {
+    resolve_level level = resolve_level::inlines;
+    bool return_addresses = true;        // pcs above the leaf are return addresses
+    std::string binary;                  // file name of the pprof mapping, none if empty
+    std::string sample_type = "samples"; // pprof name and unit of the counts
+    std::string sample_unit = "count";
+  };
+
+  explicit stack_profile(symbol_resolver& resolver);
+  stack_profile(symbol_resolver& resolver, const options& opts);
+
+  // Add count samples of stack. Empty stacks are ignored.
+  void add(std::span<const uintptr_t> stack, uint64_t count = 1);
+
+  // Add one sample of every stack.
+  void add(std::span<const std::span<const uintptr_t>> stacks);
+
+  // Drop the stacks and their counts to start a new window. The stack tables keep their capacity for
+  // the next window and the frames stay resolved for it, so memory stays at that of the largest window
+  // plus every distinct pc seen so far. With release_frames the frames go too and every table is
+  // freed, for long runs whose pcs keep changing, as with JIT code.
+  void clear(bool release_frames = false);
+
+  size_t stack_count() const { return m_stacks.size(); } // distinct stacks since clear()
+  size_t frame_count() const { return m_addrs.size(); }  // distinct pcs, kept by clear(false)
+  uint64_t sample_count() const { return m_samples; }
+
+  // One line per distinct stack: its frames root first, separated by ';', then a space and the count.
+  void write_folded(std::ostream& out);
+
+  // A pprof profile.proto, not compressed. Locations carry the inline chain innermost first.
+  void write_pprof(std::ostream& out);
+
+private:
+  struct stack_entry
+  {
+    uint32_t first; // of its frame ids in m_stack_frames
+    uint32_t depth;
+    size_t hash;
+    uint64_t count;
+  };
+
+  uintptr_t lookup_address(std::span<const uintptr_t> stack, size_t i) const;
+  size_t hash(std::span<const uintptr_t> stack) const;
+  bool same(const stack_entry& s, std::span<const uintptr_t> stack) const;
+  void grow();
+  uint32_t intern_frame(uintptr_t addr);
+  void resolve();
+
+  symbol_resolver& m_resolver;
+  const options m_opts;
+
+  // Frames by id: the address looked up and, for the first m_resolved, its resolution.
+  std::vector<uintptr_t> m_addrs;
+  std::vector<resolved_frame> m_frames;
+  size_t m_resolved = 0;
+  std::unordered_map<uintptr_t, uint32_t> m_frame_ids;
+
+  std::vector<stack_entry> m_stacks;
+  std::vector<uint32_t> m_stack_frames; // frame ids of every stack, leaf first
+  std::vector<uint32_t> m_slots;        // open addressing over m_stacks: index + 1, 0 if free
+  uint64_t m_samples = 0;
+};
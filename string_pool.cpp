@@ -0,0 +1,59 @@
+#include "string_pool.h"
+
+#include <cstring>
+
+std::string_view string_pool::intern(std::string_view s)
+{
+  std::lock_guard<std::mutex> guard(m_lock);
+
+  auto it = m_index.find(s);
+  if(it != m_index.end())
+    return *it;
+
+  std::string_view stored = store(s);
+  m_index.insert(stored);
+  return stored;
+}
+
+std::string_view string_pool::store(std::string_view s)
+{
+  const size_t need = s.size() + 1;
+  if(need > m_left)
+  {
+    // Oversized strings get a block of their own so the current block keeps its free space.
+    const size_t len = need > block_size / 4 ? need : block_size;
+    m_blocks.emplace_back(new char[len]);
+    m_block_bytes += len;
+    if(len != block_size)
+    {
+      char* p = m_blocks.back().get();
+      memcpy(p, s.data(), s.size());
+      p[s.size()] = '\0';
+      return { p, s.size() };
+    }
+    m_cur = m_blocks.back().get();
+    m_left = len;
+  }
+
+  char* p = m_cur;
+  memcpy(p, s.data(), s.size());
+  p[s.size()] = '\0';
+  m_cur += need;
+  m_left -= need;
+  return { p, s.size() };
+}
+
+size_t string_pool::size() const
+{
+  std::lock_guard<std::mutex> guard(m_lock);
+  return m_index.size();
+}
+
+size_t string_pool::memory_usage() const
+{
+  std::lock_guard<std::mutex> guard(m_lock);
+
+  // Node-based container: one node per entry plus the bucket array.
+  const size_t node = sizeof(void*) + sizeof(std::string_view) + sizeof(size_t);
+  return m_block_bytes + m_index.size() * node + m_index.bucket_count() * sizeof(void*);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+// Append-only storage for the strings handed out by symbol_resolver. Interned strings are never moved
+// or freed before the pool itself, so the returned views stay valid for the lifetime of the owner.
+// Every stored string is followed by a NUL, so view.data() can also be used as a C string. Safe to use
+// from several threads.
+class string_pool
+{
+public:
+  string_pool() = default;
+  string_pool(const string_pool&) = delete;
+  string_pool& operator=(const string_pool&) = delete;
+
+  // Return the pooled copy of s, storing it on first use. Lookups of a string that is already
+  // present do not allocate.
+  std::string_view intern(std::string_view s);
+
+  size_t size() const;
+
+  // Bytes held by the pool: string blocks plus the hash index.
+  size_t memory_usage() const;
+
+private:
+  std::string_view store(std::string_view s);
+
+  static constexpr size_t block_size = 64 * 1024;
+
+  mutable std::mutex m_lock;
+  std::vector<std::unique_ptr<char[]>> m_blocks;
+  char* m_cur = nullptr;
+  size_t m_left = 0;
+  size_t m_block_bytes = 0;
+
+  std::unordered_set<std::string_view> m_index;
+};
@@ -0,0 +1,626 @@
+#include "symbol_index.h"
+
+#include "demangle.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct symbol_index::raw_symbol
+{
+  GElf_Addr start;
+  GElf_Xword size;
+  GElf_Addr section_end;
+  const char* name;
+  uint32_t name_offset; // into the string table of an elf_image
+  int rank;             // lower is preferred among symbols with the same start
+};
+
+namespace
+{
+GElf_Addr section_end(Elf* elf, GElf_Word shndx, Dwarf_Addr bias)
+{
+  GElf_Shdr shdr_mem;
+  GElf_Shdr* shdr = elf ? gelf_getshdr(elf_getscn(elf, shndx), &shdr_mem) : nullptr;
+  return shdr ? shdr->sh_addr + shdr->sh_size + bias : GElf_Addr(-1);
+}
+
+// Mode of a file created the usual way, 0666 less the umask. umask() can only be read by setting it,
+// so it is read once, the first time an index is saved.
+mode_t new_file_mode()
+{
+  static const mode_t mode = [] {
+    const mode_t mask = umask(0);
+    umask(mask);
+    return 0666 & ~mask;
+  }();
+  return mode;
+}
+
+// Layout of a saved index. Fields are native endian and sized; a file from another architecture fails
+// the header check and is rebuilt. The header is followed by these arrays, each 8-byte aligned:
+//   uint64_t start[symbol_count]
+//   uint32_t size[symbol_count]
+//   uint32_t name[symbol_count]
+//   file_section sections[section_count]
+//   char strings[strings_size]
+constexpr char file_magic[8] = { 'S', 'Y', 'M', 'I', 'D', 'X', '\0', '\0' };
+constexpr uint32_t file_version = 1;
+constexpr size_t max_build_id = 64;
+
+struct file_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t build_id_size;
+  uint8_t build_id[max_build_id];
+  uint64_t bias;
+  uint64_t symbol_count;
+  uint64_t section_count;
+  uint64_t strings_size;
+};
+
+struct file_section
+{
+  uint64_t start;
+  uint64_t end;
+  uint64_t name; // offset into strings
+};
+
+static_assert(sizeof(uintptr_t) == sizeof(uint64_t), "saved indexes store addresses as uint64_t");
+
+constexpr size_t align8(size_t n) { return (n + 7) & ~size_t(7); }
+
+// Offsets of the arrays following the header.
+struct file_layout
+{
+  size_t start, size, name, sections, strings, end;
+
+  file_layout(uint64_t symbols, uint64_t sections_count, uint64_t strings_size)
+  {
+    start = align8(sizeof(file_header));
+    size = align8(start + symbols * sizeof(uint64_t));
+    name = align8(size + symbols * sizeof(uint32_t));
+    sections = align8(name + symbols * sizeof(uint32_t));
+    strings = align8(sections + sections_count * sizeof(file_section));
+    end = strings + strings_size;
+  }
+};
+
+// Build-id and load bias of mod, which identify a saved index. Returns false without a build-id.
+bool module_identity(Dwfl_Module* mod, file_header& h)
+{
+  const unsigned char* bits;
+  GElf_Addr vaddr;
+  const int len = dwfl_module_build_id(mod, &bits, &vaddr);
+  if(len <= 0 || size_t(len) > max_build_id)
+    return false;
+
+  GElf_Addr bias = 0;
+  if(!dwfl_module_getelf(mod, &bias))
+    return false;
+
+  h.build_id_size = len;
+  memcpy(h.build_id, bits, len);
+  h.bias = bias;
+  return true;
+}
+
+bool elf_identity(const elf_image& elf, file_header& h)
+{
+  const std::string& id = elf.build_id();
+  if(id.empty() || id.size() > max_build_id)
+    return false;
+
+  h.build_id_size = id.size();
+  memcpy(h.build_id, id.data(), id.size());
+  h.bias = elf.bias();
+  return true;
+}
+
+// The saved index at path, if it was written for the file identified by id and is sound.
+mapped_file load_file(const std::string& path, const file_header& id)
+{
+  mapped_file file(path);
+  if(!file || file.size() < sizeof(file_header))
+    return mapped_file();
+
+  const file_header* h = reinterpret_cast<const file_header*>(file.data());
+  if(memcmp(h->magic, file_magic, sizeof(file_magic)) != 0 || h->version != file_version ||
+     h->build_id_size != id.build_id_size || memcmp(h->build_id, id.build_id, id.build_id_size) != 0 ||
+     h->bias != id.bias)
+    return mapped_file();
+
+  // Bound the counts before computing offsets from them, so that the sums cannot wrap.
+  if(h->symbol_count > file.size() || h->section_count > file.size() || h->strings_size > file.size())
+    return mapped_file();
+  const file_layout layout(h->symbol_count, h->section_count, h->strings_size);
+  if(layout.end != file.size() || h->strings_size == 0 || file.data()[layout.end - 1] != '\0')
+    return mapped_file();
+
+  // Every name must start inside the string table, which ends in a NUL.
+  const uint32_t* names = reinterpret_cast<const uint32_t*>(file.data() + layout.name);
+  for(size_t i = 0; i < h->symbol_count; ++i)
+    if(names[i] >= h->strings_size)
+      return mapped_file();
+  const file_section* sections = reinterpret_cast<const file_section*>(file.data() + layout.sections);
+  for(size_t i = 0; i < h->section_count; ++i)
+    if(sections[i].name >= h->strings_size)
+      return mapped_file();
+
+  return file;
+}
+
+int binding_rank(unsigned char info)
+{
+  switch(GELF_ST_BIND(info))
+  {
+  case STB_GLOBAL:
+    return 0;
+  case STB_WEAK:
+    return 1;
+  default:
+    return 2;
+  }
+}
+}
+
+symbol_index::symbol_index(Dwfl_Module* mod, std::mutex& dwfl_lock)
+  : m_mod(mod)
+  , m_dwfl_lock(dwfl_lock)
+{
+  std::vector<raw_symbol> syms;
+  std::vector<GElf_Addr> section_ends; // by section index, 0 until looked up
+
+  const int n = dwfl_module_getsymtab(mod);
+  if(n > 0)
+    syms.reserve(n);
+
+  for(int i = 1; i < n; ++i)
+  {
+    GElf_Sym sym;
+    GElf_Addr value;
+    GElf_Word shndx;
+    Elf* elf;
+    Dwarf_Addr bias;
+    const char* name = dwfl_module_getsym_info(mod, i, &sym, &value, &shndx, &elf, &bias);
+    if(!name || name[0] == '\0' || shndx == SHN_UNDEF)
+      continue;
+
+    switch(GELF_ST_TYPE(sym.st_info))
+    {
+    case STT_SECTION:
+    case STT_FILE:
+    case STT_TLS:
+      continue;
+    }
+
+    // Prefer symbols with a size over labels, then global over weak over local bindings.
+    const int rank = (sym.st_size == 0) * 3 + binding_rank(sym.st_info);
+
+    // Absolute and other special labels only match their exact address.
+    GElf_Addr end = value;
+    if(sym.st_size == 0 && shndx < SHN_LORESERVE)
+    {
+      if(shndx >= section_ends.size())
+        section_ends.resize(shndx + 1);
+      if(!section_ends[shndx])
+        section_ends[shndx] = section_end(elf, shndx, bias);
+      end = section_ends[shndx];
+    }
+
+    syms.push_back({ value, sym.st_size, end, name, 0, rank });
+  }
+
+  build_tables(syms, nullptr);
+
+  GElf_Addr bias;
+  Elf* elf = dwfl_module_getelf(mod, &bias);
+  size_t shstrndx;
+  if(elf && elf_getshdrstrndx(elf, &shstrndx) >= 0)
+  {
+    Elf_Scn* scn = nullptr;
+    while((scn = elf_nextscn(elf, scn)) != nullptr)
+    {
+      GElf_Shdr shdr_mem;
+      GElf_Shdr* shdr = gelf_getshdr(scn, &shdr_mem);
+      if(!shdr || !(shdr->sh_flags & SHF_ALLOC) || shdr->sh_size == 0)
+        continue;
+
+      const char* name = elf_strptr(elf, shstrndx, shdr->sh_name);
+      if(name)
+        m_by_addr.push_back({ shdr->sh_addr + bias, shdr->sh_addr + bias + shdr->sh_size, name });
+    }
+
+    std::sort(m_by_addr.begin(), m_by_addr.end(), [](const section& a, const section& b) {
+      return a.start < b.start;
+    });
+  }
+}
+
+symbol_index::symbol_index(const elf_image& elf, std::mutex& dwfl_lock)
+  : m_elf(&elf)
+  , m_dwfl_lock(dwfl_lock)
+{
+  // The same selection as above, on the raw entries: dwfl_module_getsym_info returns them with the
+  // values biased by elf_image::get_symbol().
+  std::vector<raw_symbol> syms;
+  syms.reserve(elf.symbol_count());
+  for(size_t i = 1; i < elf.symbol_count(); ++i)
+  {
+    const elf_image::symbol sym = elf.get_symbol(i);
+    if(!sym.name || sym.name[0] == '\0' || sym.shndx == SHN_UNDEF)
+      continue;
+
+    switch(GELF_ST_TYPE(sym.info))
+    {
+    case STT_SECTION:
+    case STT_FILE:
+    case STT_TLS:
+      continue;
+    }
+
+    const int rank = (sym.size == 0) * 3 + binding_rank(sym.info);
+    const GElf_Addr end = sym.size == 0 && sym.shndx < SHN_LORESERVE ? elf.section_end(sym.shndx) : sym.value;
+    syms.push_back({ sym.value, sym.size, end, sym.name, sym.name_offset, rank });
+  }
+
+  build_tables(syms, elf.strings());
+
+  for(size_t i = 0; i < elf.section_count(); ++i)
+  {
+    const Elf64_Shdr& shdr = elf.section(i);
+    if(!(shdr.sh_flags & SHF_ALLOC) || shdr.sh_size == 0)
+      continue;
+
+    const char* name = elf.section_name(shdr);
+    if(name)
+      m_by_addr.push_back({ shdr.sh_addr + elf.bias(), shdr.sh_addr + elf.bias() + shdr.sh_size, name });
+  }
+
+  std::sort(m_by_addr.begin(), m_by_addr.end(), [](const section& a, const section& b) {
+    return a.start < b.start;
+  });
+}
+
+void symbol_index::build_tables(std::vector<raw_symbol>& syms, const char* strings)
+{
+  // Stable, so that among equally ranked aliases the first one in the table wins, as in libdwfl.
+  std::stable_sort(syms.begin(), syms.end(), [](const raw_symbol& a, const raw_symbol& b) {
+    return a.start != b.start ? a.start < b.start : a.rank < b.rank;
+  });
+
+  tables& t = m_owned;
+  t.start.reserve(syms.size());
+  t.size.reserve(syms.size());
+  t.name.reserve(syms.size());
+
+  GElf_Addr sized_end = 0; // highest end of the sized symbols seen so far
+  for(size_t i = 0; i < syms.size(); ++i)
+  {
+    const raw_symbol& s = syms[i];
+    if(i > 0 && s.start == syms[i - 1].start)
+      continue;
+
+    // A sizeless symbol inside a sized one is never chosen by libdwfl: the sized symbol wins inside
+    // its range, and the label is excluded above it.
+    if(s.size == 0 && s.start < sized_end)
+      continue;
+    if(s.size != 0)
+      sized_end = std::max(sized_end, s.start + s.size);
+
+    // The end of the section still counts as inside it for a label.
+    GElf_Xword size = s.size ? s.size : s.section_end >= s.start ? s.section_end - s.start + 1 : 0;
+    if(size >= label_bit)
+      size = label_bit - 1;
+
+    t.start.push_back(s.start);
+    t.size.push_back(uint32_t(size) | (s.size ? 0 : label_bit));
+    if(strings)
+      t.name.push_back(s.name_offset);
+    else
+    {
+      t.name.push_back(t.strings.size());
+      t.strings.append(s.name);
+      t.strings.push_back('\0');
+    }
+  }
+
+  t.strings.shrink_to_fit();
+
+  m_count = t.start.size();
+  m_start = t.start.data();
+  m_size = t.size.data();
+  m_name = t.name.data();
+  m_strings = strings ? strings : t.strings.data();
+  init_demangled();
+}
+
+symbol_index::symbol_index(Dwfl_Module* mod, const elf_image* elf, std::mutex& dwfl_lock, mapped_file file)
+  : m_mod(mod)
+  , m_elf(elf)
+  , m_dwfl_lock(dwfl_lock)
+  , m_file(std::move(file))
+{
+  const char* base = m_file.data();
+  const file_header* h = reinterpret_cast<const file_header*>(base);
+  const file_layout layout(h->symbol_count, h->section_count, h->strings_size);
+
+  m_count = h->symbol_count;
+  m_start = reinterpret_cast<const uintptr_t*>(base + layout.start);
+  m_size = reinterpret_cast<const uint32_t*>(base + layout.size);
+  m_name = reinterpret_cast<const uint32_t*>(base + layout.name);
+  m_strings = base + layout.strings;
+
+  const file_section* sections = reinterpret_cast<const file_section*>(base + layout.sections);
+  m_by_addr.reserve(h->section_count);
+  for(size_t i = 0; i < h->section_count; ++i)
+    m_by_addr.push_back({ sections[i].start, sections[i].end, m_strings + sections[i].name });
+
+  init_demangled();
+}
+
+void symbol_index::init_demangled()
+{
+  m_demangled_name.reset(new std::atomic<const char*>[m_count]());
+  m_demangled_len.reset(new std::atomic<uint32_t>[m_count]());
+}
+
+std::unique_ptr<symbol_index> symbol_index::load(const std::string& path, Dwfl_Module* mod, std::mutex& dwfl_lock)
+{
+  file_header id;
+  if(!module_identity(mod, id))
+    return nullptr;
+
+  mapped_file file = load_file(path, id);
+  if(!file)
+    return nullptr;
+  return std::unique_ptr<symbol_index>(new symbol_index(mod, nullptr, dwfl_lock, std::move(file)));
+}
+
+std::unique_ptr<symbol_index> symbol_index::load(const std::string& path, const elf_image& elf, std::mutex& dwfl_lock)
+{
+  file_header id;
+  if(!elf_identity(elf, id))
+    return nullptr;
+
+  mapped_file file = load_file(path, id);
+  if(!file)
+    return nullptr;
+  return std::unique_ptr<symbol_index>(new symbol_index(nullptr, &elf, dwfl_lock, std::move(file)));
+}
+
+bool symbol_index::save(const std::string& path) const
+{
+  file_header h = {};
+  if(!(m_mod ? module_identity(m_mod, h) : elf_identity(*m_elf, h)))
+    return false;
+
+  // Names are packed in table order, which also drops the unused parts of an ELF string table.
+  // Section names go after them, so that they can be mapped together.
+  std::string strings;
+  std::vector<uint32_t> names(m_count);
+  for(size_t i = 0; i < m_count; ++i)
+  {
+    names[i] = strings.size();
+    strings.append(name(i));
+    strings.push_back('\0');
+  }
+  std::vector<file_section> sections;
+  sections.reserve(m_by_addr.size());
+  for(const section& s : m_by_addr)
+  {
+    sections.push_back({ s.start, s.end, strings.size() });
+    strings.append(s.name);
+    strings.push_back('\0');
+  }
+  if(strings.empty())
+    strings.push_back('\0');
+
+  memcpy(h.magic, file_magic, sizeof(file_magic));
+  h.version = file_version;
+  h.symbol_count = m_count;
+  h.section_count = sections.size();
+  h.strings_size = strings.size();
+  const file_layout layout(h.symbol_count, h.section_count, h.strings_size);
+
+  std::string image(layout.end, '\0');
+  memcpy(&image[0], &h, sizeof(h));
+  memcpy(&image[layout.start], m_start, m_count * sizeof(uint64_t));
+  memcpy(&image[layout.size], m_size, m_count * sizeof(uint32_t));
+  memcpy(&image[layout.name], names.data(), m_count * sizeof(uint32_t));
+  memcpy(&image[layout.sections], sections.data(), sections.size() * sizeof(file_section));
+  memcpy(&image[layout.strings], strings.data(), strings.size());
+
+  // Write a private file and rename it over path, so that readers never map a partial index.
+  // mkstemp makes the name unique across the threads and processes saving the same index; it creates
+  // the file 0600, so give it the mode the umask asks for.
+  std::string tmp = path + ".XXXXXX";
+  const int fd = mkstemp(tmp.data());
+  if(fd < 0)
+    return false;
+  FILE* f = fchmod(fd, new_file_mode()) == 0 ? fdopen(fd, "wb") : nullptr;
+  if(!f)
+  {
+    close(fd);
+    unlink(tmp.c_str());
+    return false;
+  }
+
+  const bool written = fwrite(image.data(), 1, image.size(), f) == image.size();
+  if(fclose(f) != 0 || !written || rename(tmp.c_str(), path.c_str()) != 0)
+  {
+    unlink(tmp.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+size_t symbol_index::find(uintptr_t addr) const
+{
+  const uintptr_t* base = m_start;
+  size_t n = m_count;
+  if(n == 0 || addr < base[0])
+    return npos;
+
+  // Branchless lower bound: find the last start <= addr.
+  while(n > 1)
+  {
+    const size_t half = n / 2;
+    base = base[half] <= addr ? base + half : base;
+    n -= half;
+  }
+  const size_t i = base - m_start;
+
+  // A sized symbol containing addr. The nearest one usually is, but it can be nested inside a larger
+  // symbol that starts before it, so look back a few entries.
+  constexpr size_t max_nesting = 8;
+  for(size_t k = i, left = max_nesting; left && k != npos; --k, --left)
+    if(!(m_size[k] & label_bit) && addr - m_start[k] < m_size[k])
+      return k;
+
+  // Otherwise the nearest label, if it is in the same section. Labels below the end of a sized symbol
+  // were dropped at build time.
+  return (m_size[i] & label_bit) && addr - m_start[i] < (m_size[i] & ~label_bit) ? i : npos;
+}
+
+std::string_view symbol_index::demangled_name(size_t i) const
+{
+  const char* cached = m_demangled_name[i].load(std::memory_order_acquire);
+  if(cached)
+    return { cached, m_demangled_len[i].load(std::memory_order_relaxed) };
+
+  std::string_view demangled = demangle(name(i), m_demangled);
+  m_demangled_len[i].store(demangled.size(), std::memory_order_relaxed);
+  m_demangled_name[i].store(demangled.data(), std::memory_order_release);
+  return demangled;
+}
+
+void symbol_index::demangle_all() const
+{
+  for(size_t i = 0; i < m_count; ++i)
+    demangled_name(i);
+}
+
+const symbol_index::named_symbol* symbol_index::find_name(std::string_view name) const
+{
+  std::call_once(m_names_once, &symbol_index::build_names, this);
+
+  auto it = m_by_name.find(name);
+  return it != m_by_name.end() ? &it->second : nullptr;
+}
+
+void symbol_index::build_names() const
+{
+  if(m_elf)
+  {
+    m_by_name.reserve(m_elf->symbol_count());
+    for(size_t i = 1; i < m_elf->symbol_count(); ++i)
+    {
+      const elf_image::symbol sym = m_elf->get_symbol(i);
+      if(!sym.name || sym.name[0] == '\0')
+        continue;
+
+      switch(GELF_ST_TYPE(sym.info))
+      {
+      case STT_SECTION:
+      case STT_FILE:
+      case STT_TLS:
+        continue;
+      }
+
+      m_by_name.emplace(sym.name, named_symbol{ sym.value, sym.size });
+    }
+    return;
+  }
+
+  std::lock_guard<std::mutex> guard(m_dwfl_lock);
+
+  const int n = dwfl_module_getsymtab(m_mod);
+  if(n > 0)
+    m_by_name.reserve(n);
+
+  for(int i = 1; i < n; ++i)
+  {
+    GElf_Sym sym;
+    GElf_Addr value;
+    const char* name = dwfl_module_getsym_info(m_mod, i, &sym, &value, nullptr, nullptr, nullptr);
+    if(!name || name[0] == '\0')
+      continue;
+
+    switch(GELF_ST_TYPE(sym.st_info))
+    {
+    case STT_SECTION:
+    case STT_FILE:
+    case STT_TLS:
+      continue;
+    }
+
+    // emplace keeps the first definition of a name.
+    m_by_name.emplace(name, named_symbol{ value, sym.st_size });
+  }
+}
+
+const symbol_index::section_range* symbol_index::find_section(std::string_view name) const
+{
+  std::call_once(m_sections_once, &symbol_index::build_sections, this);
+
+  auto it = m_sections.find(name);
+  return it != m_sections.end() ? &it->second : nullptr;
+}
+
+void symbol_index::build_sections() const
+{
+  // Only relocatable files have sections to give offsets in, and an elf_image is never one.
+  if(!m_mod)
+    return;
+
+  std::lock_guard<std::mutex> guard(m_dwfl_lock);
+
+  GElf_Addr bias;
+  Elf* elf = dwfl_module_getelf(m_mod, &bias);
+
+  const int nscn = dwfl_module_relocations(m_mod);
+  for(int i = 0; i < nscn; ++i)
+  {
+    GElf_Word shndx;
+    const char* scn = dwfl_module_relocation_info(m_mod, i, &shndx);
+    if(!scn) // [[unlikely]]
+      break;
+
+    GElf_Shdr shdr_mem;
+    GElf_Shdr* shdr = gelf_getshdr(elf_getscn(elf, shndx), &shdr_mem);
+    if(!shdr) // [[unlikely]]
+      break;
+
+    m_sections.emplace(scn, section_range{ shdr->sh_addr + bias, shdr->sh_size });
+  }
+}
+
+const char* symbol_index::section_name(uintptr_t addr) const
+{
+  auto it = std::upper_bound(m_by_addr.begin(), m_by_addr.end(), addr, [](uintptr_t a, const section& s) {
+    return a < s.start;
+  });
+  if(it == m_by_addr.begin() || addr >= (--it)->end)
+    return nullptr;
+  return it->name;
+}
+
+size_t symbol_index::demangle_memory_usage() const
+{
+  return m_demangled.memory_usage() + m_count * (sizeof(std::atomic<const char*>) + sizeof(std::atomic<uint32_t>));
+}
+
+size_t symbol_index::memory_usage() const
+{
+  const tables& t = m_owned;
+  return t.start.capacity() * sizeof(uintptr_t) + t.size.capacity() * sizeof(uint32_t) +
+         t.name.capacity() * sizeof(uint32_t) + t.strings.capacity() + m_file.size() +
+         m_by_addr.capacity() * sizeof(section);
+}
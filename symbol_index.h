@@ -0,0 +1,154 @@
+#pragma once
+
+#include "elf_image.h"
+#include "mapped_file.h"
+#include "string_pool.h"
+
+#include <libdwfl.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Sorted, flat table of the ELF symbols of one module, built once and then searched instead of going
+// through dwfl_module_addrinfo. The table is kept as separate arrays so the binary search only touches
+// the start addresses. Symbols are filtered and ranked the way libdwfl does it, so lookups return the
+// same symbol dwfl_module_addrinfo would.
+//
+// The index is immutable once constructed, except for the name tables built on first use, so any
+// number of threads can search it. It is constructed with dwfl_lock held; the lazy builders take
+// dwfl_lock themselves, so callers must not hold it when asking for names or sections.
+//
+// An index can be saved to a file keyed by the module's build-id and mapped by a later process, which
+// then searches the file in place instead of reading the symbol table again. The file holds the
+// symbols and section ranges only: line tables and inline tables are still built from the DWARF in
+// every process, on first use or by prewarming, so a saved index speeds up symbol lookups alone.
+//
+// Instead of a libdwfl module, the index can read an elf_image. The symbol names then stay in the
+// mapped string table of the file and are not copied.
+class symbol_index
+{
+public:
+  static constexpr size_t npos = size_t(-1);
+
+  struct named_symbol
+  {
+    uintptr_t value;
+    uintptr_t size;
+  };
+
+  struct section_range
+  {
+    uintptr_t addr;
+    uintptr_t size;
+  };
+
+  symbol_index(Dwfl_Module* mod, std::mutex& dwfl_lock);
+  symbol_index(const elf_image& elf, std::mutex& dwfl_lock);
+  symbol_index(const symbol_index&) = delete;
+  symbol_index& operator=(const symbol_index&) = delete;
+
+  // Map the index of mod saved at path. Returns nullptr if the file is missing, damaged, from another
+  // format version, or was written for a different build-id or load bias. Call with dwfl_lock held.
+  static std::unique_ptr<symbol_index> load(const std::string& path, Dwfl_Module* mod, std::mutex& dwfl_lock);
+  static std::unique_ptr<symbol_index> load(const std::string& path, const elf_image& elf, std::mutex& dwfl_lock);
+
+  // Write the index to path for load(), replacing the file atomically. Returns false if the module
+  // has no build-id or the file cannot be written. Call with dwfl_lock held.
+  bool save(const std::string& path) const;
+
+  // Index of the symbol covering addr, or npos.
+  size_t find(uintptr_t addr) const;
+
+  uintptr_t start(size_t i) const { return m_start[i]; }
+  uintptr_t size(size_t i) const { return m_size[i] & label_bit ? 0 : m_size[i]; }
+  const char* name(size_t i) const { return m_strings + m_name[i]; }
+
+  // Demangled name of symbol i. Each symbol is demangled once, on first use, into the module's own
+  // intern table; later calls only load the cached view.
+  std::string_view demangled_name(size_t i) const;
+
+  // Whether demangled_name(i) is already cached.
+  bool is_demangled(size_t i) const { return m_demangled_name[i].load(std::memory_order_relaxed) != nullptr; }
+
+  // Demangle every symbol now instead of on first use.
+  void demangle_all() const;
+
+  // First symbol called name in table order, as the symbol[+offset] input syntax expects. The name
+  // table is built on the first call.
+  const named_symbol* find_name(std::string_view name) const;
+
+  // Relocatable section called name, for the (section)+offset input syntax. Built on the first call.
+  const section_range* find_section(std::string_view name) const;
+
+  // Name of the allocated section containing addr, or nullptr.
+  const char* section_name(uintptr_t addr) const;
+
+  size_t count() const { return m_count; }
+  bool is_mapped() const { return bool(m_file); }
+  size_t memory_usage() const;
+  size_t demangle_memory_usage() const;
+
+private:
+  struct raw_symbol;
+
+  symbol_index(Dwfl_Module* mod, const elf_image* elf, std::mutex& dwfl_lock, mapped_file file);
+
+  // Rank syms the way libdwfl does and fill m_owned with the ones it can return. Names are copied into
+  // m_owned.strings, or with strings given, are used in place by their offset into it.
+  void build_tables(std::vector<raw_symbol>& syms, const char* strings);
+  void init_demangled();
+  void build_names() const;
+  void build_sections() const;
+
+  Dwfl_Module* m_mod = nullptr;
+  const elf_image* m_elf = nullptr; // instead of m_mod
+  std::mutex& m_dwfl_lock;
+
+  // Sizeless symbols (assembly labels) store the distance to the end of their section instead, with
+  // this bit set: libdwfl only uses them for addresses in the same section.
+  static constexpr uint32_t label_bit = 0x80000000u;
+
+  // The tables, pointing either into m_owned or into m_file.
+  size_t m_count = 0;
+  const uintptr_t* m_start = nullptr;
+  const uint32_t* m_size = nullptr;
+  const uint32_t* m_name = nullptr; // offset into m_strings
+  const char* m_strings = nullptr;  // NUL separated names, in m_owned, m_file or m_elf
+
+  struct tables
+  {
+    std::vector<uintptr_t> start;
+    std::vector<uint32_t> size;
+    std::vector<uint32_t> name;
+    std::string strings;
+  };
+  tables m_owned;     // built from the module or the image
+  mapped_file m_file; // or loaded from a saved index
+
+  struct section
+  {
+    uintptr_t start;
+    uintptr_t end;
+    const char* name; // in the ELF section header string table, or in m_file
+  };
+  std::vector<section> m_by_addr; // allocated sections, sorted
+
+  // Per symbol: demangled name, nullptr until first use. The length is stored before the pointer is
+  // published. Racing threads demangle the same name to the same interned string.
+  mutable string_pool m_demangled;
+  std::unique_ptr<std::atomic<const char*>[]> m_demangled_name;
+  std::unique_ptr<std::atomic<uint32_t>[]> m_demangled_len;
+
+  // Keyed by views into the module's string tables, which live as long as the module.
+  mutable std::once_flag m_names_once;
+  mutable std::unordered_map<std::string_view, named_symbol> m_by_name;
+  mutable std::once_flag m_sections_once;
+  mutable std::unordered_map<std::string_view, section_range> m_sections;
+};
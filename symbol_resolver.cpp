@@ -2,11 +2,15 @@
 
 #include "symbol_resolver.h"
 
-#include <argp.h>
+#include "debug_file_cache.h"
+#include "demangle.h"
+
 #include <dwarf.h>
+#include <libdwelf.h>
 #include <libdwfl.h>
 #include <libintl.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cinttypes>
 #include <cinttypes>
@@ -14,150 +18,710 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
-#include <cxxabi.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <iostream>
 #include <locale.h>
-#include <sstream>
+#include <numeric>
 #include <stdexcept>
-#include <stdio_ext.h>
+#include <system_error>
 #include <unistd.h>
 
-// Definitions of arguments for argp functions.
-static const argp_option options[] =
-{
-  { nullptr, 0, nullptr, 0, "Input format options:", 2 },
-  { "section", 'j', "NAME", 0, "Treat addresses as offsets relative to NAME section.", 0 },
-  { nullptr, 0, nullptr, 0, "Output format options:", 3 },
-  { "addresses", 'a', nullptr, 0, "Print address before each entry", 0 },
-  { "basenames", 's', nullptr, 0, "Show only base names of source files", 0 },
-  { "absolute", 'A', nullptr, 0, "Show absolute file names using compilation directory", 0 },
-  { "flags", 'F', nullptr, 0, "Also show line table flags", 0 },
-  { "inlines", 'i', nullptr, 0, "Show all source locations that caused inline expansion of subroutines at the address.", 0 },
-  { nullptr, 0, nullptr, 0, "Miscellaneous:", 0 },
-  { nullptr, 0, nullptr, 0, nullptr, 0 }
+namespace
+{
+// Buffers reused by every lookup made on the same thread.
+struct scratch
+{
+  std::string path;            // comp_dir + file
+  std::vector<uint32_t> order; // resolve_batch() positions by address
 };
 
-// Short description of program.
-//static const char doc[] = "Locate source files and line information for ADDRs (in a.out by default).";
+thread_local scratch t_scratch;
+}
 
-// Strings for arguments in help texts.
-//static const char args_doc[] = "[ADDR...]";
+symbol_resolver::symbol_resolver(const std::string& fname)
+  : symbol_resolver(fname, options())
+{
+}
 
-// Prototype for option handler.
-static error_t parse_opt(int key, char* arg, argp_state* state);
+symbol_resolver::symbol_resolver(const std::string& fname, const options& opts)
+  : m_opts(opts)
+  , m_cache(opts.cache_entries)
+  , m_stats(opts.stats_sample_period)
+{
+  // The symbols level only needs the symbol table, which can be read from the file in place. Files
+  // whose symbols libdwfl would find elsewhere still go through it.
+  if(m_opts.symbols_only)
+  {
+    auto elf = std::make_unique<elf_image>(fname, m_opts.debug_dirs);
+    if(*elf)
+    {
+      m_elf = std::move(elf);
+      auto m = std::make_unique<module_entry>();
+      m->file = fname;
+      m->lo = m_elf->low();
+      m->hi = m_elf->high();
+      m_by_addr.push_back(m.get());
+      m_modules.push_back(std::move(m));
+      m_build_id = m_elf->build_id();
+      if(m_opts.prewarm_threads)
+        m_prewarm = std::thread(&symbol_resolver::prewarm, this);
+      return;
+    }
+  }
 
-static argp_child argp_children[2]; // [0] is set in main.
+  // The callbacks dwfl_standard_argp() installs for -e: the file is reported as an offline module and
+  // separate debug info is searched in the default locations, after debug_dirs if there are any.
+  if(!m_opts.debug_dirs.empty())
+  {
+    m_debuginfo_path = m_opts.debug_dirs + ":" + ":.debug:/usr/lib/debug";
+    m_debuginfo_path_ptr = m_debuginfo_path.data();
+  }
+  m_callbacks.find_elf = dwfl_build_id_find_elf;
+  m_callbacks.find_debuginfo = find_debuginfo;
+  m_callbacks.section_address = dwfl_offline_section_address;
+  m_callbacks.debuginfo_path = &m_debuginfo_path_ptr;
+
+  m_dwfl = dwfl_begin(&m_callbacks);
+  if(!m_dwfl)
+    throw std::runtime_error(dwfl_errmsg(-1));
+
+  // This opens the module, like argp_parse() of "-e fname" did. dwfl_standard_argp() starts laying
+  // out offline modules at address 0 so a lone DSO shows without bias; report it at base 0 directly.
+  dwfl_report_begin(m_dwfl);
+  if(!dwfl_report_elf(m_dwfl, "", fname.c_str(), -1, 0, false))
+  {
+    std::string msg = fname + ": " + dwfl_errmsg(-1);
+    dwfl_end(m_dwfl);
+    throw std::runtime_error(msg);
+  }
+  dwfl_report_end(m_dwfl, nullptr, nullptr);
+
+  // The module userdata leads find_debuginfo() back to this resolver.
+  auto collect_module = [](Dwfl_Module* mod, void** userdata, const char*, Dwarf_Addr, void* arg) {
+    auto self = static_cast<symbol_resolver*>(arg);
+    *userdata = self;
+    auto m = std::make_unique<module_entry>();
+    m->mod = mod;
+    const char* file = nullptr;
+    dwfl_module_info(mod, nullptr, &m->lo, &m->hi, nullptr, nullptr, &file, nullptr);
+    if(file)
+      m->file = file;
+    self->m_modules.push_back(std::move(m));
+    return int(DWARF_CB_OK);
+  };
+  dwfl_getmodules(m_dwfl, collect_module, this, 0);
+
+  for(auto& m : m_modules)
+    m_by_addr.push_back(m.get());
+  std::sort(m_by_addr.begin(), m_by_addr.end(), [](const module_entry* a, const module_entry* b) {
+    return a->lo < b->lo;
+  });
+
+  const unsigned char* bits;
+  GElf_Addr vaddr;
+  const int len = m_modules.empty() ? 0 : dwfl_module_build_id(m_modules[0]->mod, &bits, &vaddr);
+  if(len > 0)
+    m_build_id.assign(reinterpret_cast<const char*>(bits), len);
+
+  if(m_opts.prewarm_threads)
+    m_prewarm = std::thread(&symbol_resolver::prewarm, this);
+}
 
-// Data structure to communicate with argp functions.
-static const argp argp =
+symbol_resolver::~symbol_resolver()
 {
-  //options, parse_opt, args_doc, doc, argp_children, nullptr, nullptr
-  options, parse_opt, nullptr, nullptr, argp_children, nullptr, nullptr
-};
+  m_prewarm_stop.store(true, std::memory_order_relaxed);
+  if(m_prewarm.joinable())
+    m_prewarm.join();
+  dwfl_end(m_dwfl);
+}
 
-static bool print_addresses;             // True when we should print the address for each entry.
-static bool only_basenames;              // True if only base names of files should be shown.
-static bool use_comp_dir;                // True if absolute file names based on DW_AT_comp_dir should be shown.
-static bool show_flags;                  // True if line flags should be shown.
-static bool show_functions = true;       // True if function names should be shown.
-static bool show_symbols = true;         // True if ELF symbol or section info should be shown.
-static bool show_symbol_sections = true; // True if section associated with a symbol address should be shown.
-static const char* just_section;         // If non-null, take address parameters as relative to named section.
-static bool show_inlines;                // True if all inlined subroutines of the current address should be shown.
-static bool demangle = true;             // True if all names need to be demangled.
-static bool pretty = true;               // True if all information should be printed on one line.
+// find_debuginfo callback of m_dwfl. libdwfl only calls it for modules whose own file has no DWARF.
+int symbol_resolver::find_debuginfo(Dwfl_Module* mod, void** userdata, const char* modname, Dwarf_Addr base,
+                                    const char* file_name, const char* debuglink_file,
+                                    GElf_Word debuglink_crc, char** debuginfo_file_name)
+{
+  int fd = dwfl_standard_find_debuginfo(mod, userdata, modname, base, file_name, debuglink_file,
+                                        debuglink_crc, debuginfo_file_name);
+  auto self = static_cast<symbol_resolver*>(*userdata);
+  if(!self || (fd >= 0 && !self->m_opts.debug_cache))
+    return fd;
 
-symbol_resolver::symbol_resolver(const std::string& fname)
+  const unsigned char* bits;
+  GElf_Addr vaddr;
+  const int len = dwfl_module_build_id(mod, &bits, &vaddr);
+  const std::string build_id = len > 0 ? std::string(reinterpret_cast<const char*>(bits), len) : std::string();
+
+  if(fd < 0)
+    fd = self->find_in_debug_dirs(build_id, debuglink_file, debuginfo_file_name);
+
+  if(fd >= 0 && self->m_opts.debug_cache && *debuginfo_file_name)
+  {
+    const int cached = self->m_opts.debug_cache->open(build_id, *debuginfo_file_name);
+    if(cached >= 0)
+    {
+      close(fd);
+      fd = cached;
+    }
+  }
+  return fd;
+}
+
+// The layouts of debug_dirs that libdwfl does not search: the .gnu_debuglink name and <build-id>.debug
+// directly in the directory, and <build-id>/debuginfo of a debuginfod cache. A candidate is only taken
+// if its build-id is the one of the module, which needs the module to have one.
+int symbol_resolver::find_in_debug_dirs(const std::string& build_id, const char* debuglink_file,
+                                        char** debuginfo_file_name)
 {
-  char buff0[256];
-  char buff1[256];
-  char buff2[256];
-  strcpy(buff0, "exe");
-  strcpy(buff1, "-e");
-  strcpy(buff2, fname.c_str());
+  if(build_id.empty())
+    return -1;
 
-  const int argc = 3;
-  char* argv[] = { buff0, buff1, buff2 };
+  std::string hex;
+  for(unsigned char c : build_id)
+  {
+    char digits[3];
+    snprintf(digits, sizeof(digits), "%02x", c);
+    hex += digits;
+  }
 
-  // We use no threads here which can interfere with handling a stream.
-  __fsetlocking(stdout, FSETLOCKING_BYCALLER);
+  const std::string& dirs = m_opts.debug_dirs;
+  for(size_t pos = 0; pos < dirs.size();)
+  {
+    const size_t end = std::min(dirs.find(':', pos), dirs.size());
+    const std::string dir = dirs.substr(pos, end - pos);
+    pos = end + 1;
+    if(dir.empty())
+      continue;
 
-  // Parse and process arguments.  This includes opening the modules.
-  argp_children[0].argp = dwfl_standard_argp();
-  argp_children[0].group = 1;
+    std::string candidates[3] = { dir + '/' + hex + ".debug", dir + '/' + hex + "/debuginfo" };
+    if(debuglink_file)
+      candidates[2] = dir + '/' + debuglink_file;
+    for(const std::string& path : candidates)
+    {
+      if(path.empty())
+        continue;
+      const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if(fd < 0)
+        continue;
 
-  int remaining;
-  argp_parse(&argp, argc, argv, 0, &remaining, &m_dwfl);
-  assert(m_dwfl);
+      Elf* elf = elf_begin(fd, ELF_C_READ_MMAP, nullptr);
+      const void* id = nullptr;
+      const ssize_t id_len = elf ? dwelf_elf_gnu_build_id(elf, &id) : -1;
+      const bool match = id_len == ssize_t(build_id.size()) && memcmp(id, build_id.data(), id_len) == 0;
+      elf_end(elf);
+      if(match)
+      {
+        *debuginfo_file_name = strdup(path.c_str());
+        return fd;
+      }
+      close(fd);
+    }
+  }
+  return -1;
 }
 
-symbol_resolver::~symbol_resolver()
+void symbol_resolver::wait_prewarm()
 {
-  dwfl_end(m_dwfl);
-  free(demangle_buffer);
+  if(!m_prewarm.joinable())
+    return;
+  std::unique_lock<std::mutex> guard(m_prewarm_lock);
+  m_prewarm_done.wait(guard, [this] { return m_prewarmed.load(std::memory_order_relaxed); });
+}
+
+// Body of m_prewarm. The modules are warmed one after the other with all the threads: this one builds
+// the symbol index while the others start on the CUs, then joins them there.
+void symbol_resolver::prewarm()
+{
+  for(auto& m : m_modules)
+  {
+    if(m_prewarm_stop.load(std::memory_order_relaxed))
+      break;
+
+    dwarf_file file;
+    if(m->mod && !m_opts.symbols_only)
+    {
+      std::lock_guard<std::mutex> guard(m_dwfl_lock);
+      if(Dwarf* dwarf = dwfl_module_getdwarf(m->mod, &file.bias))
+      {
+        const char* mainfile = nullptr;
+        const char* debugfile = nullptr;
+        dwfl_module_info(m->mod, nullptr, nullptr, nullptr, nullptr, nullptr, &mainfile, &debugfile);
+        if(const char* path = debugfile ?: mainfile)
+          file.path = path;
+        file.need_alt = dwarf_getalt(dwarf) != nullptr;
+
+        const unsigned char* bits;
+        GElf_Addr vaddr;
+        const int len = dwfl_module_build_id(m->mod, &bits, &vaddr);
+        if(debugfile && m_opts.debug_cache && len > 0)
+          file.build_id.assign(reinterpret_cast<const char*>(bits), len);
+      }
+    }
+
+    std::atomic<size_t> next_cu{ 0 };
+    std::vector<std::thread> helpers;
+    for(unsigned i = 1; !file.path.empty() && i < m_opts.prewarm_threads; ++i)
+    {
+      try
+      {
+        helpers.emplace_back(&symbol_resolver::prewarm_units, this, std::cref(file), std::ref(next_cu));
+      }
+      catch(const std::system_error&)
+      {
+        break; // the threads started so far share the work
+      }
+    }
+
+    try
+    {
+      module_index(*m);
+    }
+    catch(const std::exception&)
+    {
+      // The lookups in this module fail the same way and report it.
+    }
+    if(!file.path.empty())
+      prewarm_units(file, next_cu);
+
+    for(std::thread& t : helpers)
+      t.join();
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(m_prewarm_lock);
+    m_prewarmed.store(true, std::memory_order_release);
+  }
+  m_prewarm_done.notify_all();
+}
+
+// Build the line and inline tables of the CUs in the DWARF file, each thread taking the next CU that
+// no other thread took. The file is opened again, from the debug cache if it is there, so that these
+// libdw calls need no lock; DIE offsets, which key m_lines, are the same as in the copy m_dwfl has open.
+void symbol_resolver::prewarm_units(const dwarf_file& file, std::atomic<size_t>& next)
+{
+  int fd = file.build_id.empty() ? -1 : m_opts.debug_cache->open(file.build_id, file.path);
+  if(fd < 0)
+    fd = open(file.path.c_str(), O_RDONLY | O_CLOEXEC);
+  if(fd < 0)
+    return;
+  const Dwarf_Addr bias = file.bias;
+
+  // Without the supplementary file libdwfl found, the names kept there would be missing; that DWARF is
+  // left to the lookups.
+  Dwarf* dwarf = dwarf_begin(fd, DWARF_C_READ);
+  if(dwarf && (!file.need_alt || dwarf_getalt(dwarf)))
+  {
+    size_t claimed = next.fetch_add(1, std::memory_order_relaxed);
+    size_t i = 0;
+    Dwarf_CU* cu = nullptr;
+    Dwarf_Half version;
+    uint8_t unit_type;
+    Dwarf_Die cudie;
+    while(!m_prewarm_stop.load(std::memory_order_relaxed) &&
+          dwarf_get_units(dwarf, cu, &cu, &version, &unit_type, &cudie, nullptr) == 0)
+    {
+      if(i++ != claimed)
+        continue;
+      claimed = next.fetch_add(1, std::memory_order_relaxed);
+
+      // Type units hold no code, and the lookups find split DWARF through the skeleton units.
+      if(unit_type != DW_UT_compile)
+        continue;
+
+      try
+      {
+        const uint64_t offset = dwarf_dieoffset(&cudie);
+        if(!m_lines.cu_table(offset))
+          m_lines.insert(offset, build_lines(&cudie, bias, true));
+        prewarm_functions(&cudie, &cudie, bias, true);
+      }
+      catch(const std::bad_alloc&)
+      {
+        break;
+      }
+    }
+  }
+
+  dwarf_end(dwarf);
+  close(fd);
+}
+
+// Build the inline tables of the functions defined in die, looking into namespaces and classes. The
+// lookups build those of nested functions. copy_strings as for build_inlines(), for DWARF that is
+// closed afterwards.
+void symbol_resolver::prewarm_functions(Dwarf_Die* die, Dwarf_Die* cu, Dwarf_Addr bias, bool copy_strings)
+{
+  Dwarf_Die child;
+  if(dwarf_child(die, &child) != 0)
+    return;
+
+  do
+  {
+    switch(dwarf_tag(&child))
+    {
+      case DW_TAG_subprogram:
+      {
+        Dwarf_Addr base, lo, hi;
+        if(dwarf_ranges(&child, 0, &base, &lo, &hi) > 0 && !m_inlines.find(lo + bias))
+          if(auto table = build_inlines(&child, cu, bias, copy_strings))
+            m_inlines.insert(std::move(table));
+        break;
+      }
+
+      case DW_TAG_namespace:
+      case DW_TAG_module:
+      case DW_TAG_class_type:
+      case DW_TAG_structure_type:
+      case DW_TAG_union_type:
+        prewarm_functions(&child, cu, bias, copy_strings);
+        break;
+
+      default:
+        break;
+    }
+  }
+  while(dwarf_siblingof(&child, &child) == 0);
+}
+
+int symbol_resolver::resolve(uintptr_t addr, resolved_frame& frame)
+{
+  return resolve(addr, frame, m_opts.level);
+}
+
+int symbol_resolver::resolve(uintptr_t addr, resolved_frame& frame, resolve_level level)
+{
+  frame = {};
+  frame.address = addr;
+
+  uintmax_t a = addr;
+  if(!m_opts.just_section.empty() && !adjust_to_section(m_opts.just_section, &a))
+    return 1;
+
+  lookup_cursor cur;
+  cur.timed = m_stats.sample();
+  return frame.status = resolve_address(a, level, cur, frame);
 }
 
 int symbol_resolver::resolve(uintptr_t addr, std::string& symbol)
 {
-  std::ostringstream os;
-  os << std::hex << addr;
-  return handle_address(os.str().c_str(), symbol);
+  resolved_frame frame;
+  int res = resolve(addr, frame);
+  if(!frame.name.empty() && frame.offset == 0)
+    symbol.assign(frame.name);
+  return res;
+}
+
+size_t symbol_resolver::resolve_batch(std::span<const uintptr_t> addrs, std::span<resolved_frame> results)
+{
+  return resolve_batch(addrs, results, m_opts.level);
 }
 
-const char* symbol_resolver::symname(const char* name)
+size_t symbol_resolver::resolve_batch(std::span<const uintptr_t> addrs, std::span<resolved_frame> results,
+                                      resolve_level level)
 {
-  // Require GNU v3 ABI by the "_Z" prefix.
-  if(demangle && name[0] == '_' && name[1] == 'Z')
+  assert(results.size() >= addrs.size());
+
+  // Walk the addresses in ascending order so that consecutive lookups stay in the same module, CU and
+  // function as long as possible and the cursor state can be reused.
+  std::vector<uint32_t>& order = t_scratch.order;
+  order.resize(addrs.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return addrs[a] < addrs[b]; });
+
+  lookup_cursor cur;
+  const resolved_frame* prev = nullptr;
+  size_t failed = 0;
+  for(size_t k = 0; k < order.size(); ++k)
   {
-    int status = -1;
-    char* dsymname = __cxxabiv1::__cxa_demangle(name, demangle_buffer,
-                                                &demangle_buffer_len, &status);
-    if(status == 0)
-      name = demangle_buffer = dsymname;
+    const uint32_t i = order[k];
+    resolved_frame& res = results[i];
+
+    if(prev && addrs[order[k - 1]] == addrs[i])
+      res = *prev; // duplicate address
+    else
+    {
+      uintmax_t addr = addrs[i];
+      res = {};
+      res.address = addr;
+      if(!m_opts.just_section.empty() && !adjust_to_section(m_opts.just_section, &addr))
+        res.status = 1;
+      else
+      {
+        cur.timed = m_stats.sample();
+        res.status = resolve_address(addr, level, cur, res);
+      }
+      prev = &res;
+    }
+
+    if(res.status != 0)
+      ++failed;
   }
 
-  return name;
+  return failed;
 }
 
-// Handle program arguments
-static error_t parse_opt(int key, char* arg, argp_state* state)
+void symbol_resolver::seek_module(lookup_cursor& cur, Dwarf_Addr addr)
 {
-  switch(key)
+  if(cur.index && addr >= cur.mod_lo && addr < cur.mod_hi)
+    return;
+
+  stage_timer timer(m_stats, resolver_stage::module, cur.timed);
+  const bool timed = cur.timed;
+  free(cur.scopes);
+  cur = {};
+  cur.timed = timed;
+
+  module_entry* m = find_module(addr);
+  if(m)
   {
-  case ARGP_KEY_INIT:
-    state->child_inputs[0] = state->input;
-    break;
+    cur.mod = m->mod;
+    cur.mod_lo = m->lo;
+    cur.mod_hi = m->hi;
+    bool built = false;
+    cur.index = module_index(*m, &built);
+    if(built)
+      timer.miss();
+  }
+}
 
-  case 'a':
-    print_addresses = true;
-    break;
+symbol_resolver::module_entry* symbol_resolver::find_module(Dwarf_Addr addr) const
+{
+  auto it = std::upper_bound(m_by_addr.begin(), m_by_addr.end(), addr, [](Dwarf_Addr a, const module_entry* m) {
+    return a < m->lo;
+  });
+  if(it == m_by_addr.begin() || addr >= (*--it)->hi)
+    return nullptr;
+  return *it;
+}
 
-  case 's':
-    only_basenames = true;
-    break;
+const symbol_index* symbol_resolver::module_index(module_entry& m, bool* built)
+{
+  std::call_once(m.index_once, [&] {
+    if(built)
+      *built = true;
+    std::lock_guard<std::mutex> guard(m_dwfl_lock);
+    const std::string path = index_path(m);
+    if(!path.empty())
+      m.index = m.mod ? symbol_index::load(path, m.mod, m_dwfl_lock) : symbol_index::load(path, *m_elf, m_dwfl_lock);
+    if(!m.index)
+    {
+      if(m.mod)
+        m.index = std::make_unique<symbol_index>(m.mod, m_dwfl_lock);
+      else
+        m.index = std::make_unique<symbol_index>(*m_elf, m_dwfl_lock);
+      if(!path.empty())
+        m.index->save(path);
+    }
+    if(m_opts.demangle && m_opts.demangle_ahead)
+      m.index->demangle_all();
+    m.ready.store(m.index.get(), std::memory_order_release);
+  });
+  return m.index.get();
+}
 
-  case 'A':
-    use_comp_dir = true;
-    break;
+bool symbol_resolver::file_offset_address(uint64_t offset, uintptr_t& addr)
+{
+  if(m_elf)
+    return m_elf->file_offset_address(offset, addr);
+  if(m_modules.empty())
+    return false;
 
-  case 'F':
-    show_flags = true;
-    break;
+  std::lock_guard<std::mutex> guard(m_dwfl_lock);
+  GElf_Addr bias;
+  Elf* elf = dwfl_module_getelf(m_modules[0]->mod, &bias);
+  size_t phnum;
+  if(!elf || elf_getphdrnum(elf, &phnum) != 0)
+    return false;
 
-  case 'j':
-    just_section = arg;
-    break;
+  for(size_t i = 0; i < phnum; ++i)
+  {
+    GElf_Phdr phdr_mem;
+    GElf_Phdr* phdr = gelf_getphdr(elf, i, &phdr_mem);
+    if(phdr && phdr->p_type == PT_LOAD && offset >= phdr->p_offset && offset - phdr->p_offset < phdr->p_filesz)
+    {
+      addr = phdr->p_vaddr + bias + (offset - phdr->p_offset);
+      return true;
+    }
+  }
 
-  case 'i':
-    show_inlines = true;
-    break;
+  return false;
+}
 
-  default:
-    return ARGP_ERR_UNKNOWN;
+std::string symbol_resolver::index_path(const module_entry& m) const
+{
+  const unsigned char* bits = reinterpret_cast<const unsigned char*>(m_build_id.data());
+  GElf_Addr vaddr;
+  int len = m_build_id.size();
+  if(m.mod)
+    len = dwfl_module_build_id(m.mod, &bits, &vaddr);
+  if(m_opts.index_dir.empty() || len <= 0)
+    return std::string();
+
+  std::string path = m_opts.index_dir;
+  path += '/';
+  for(int i = 0; i < len; ++i)
+  {
+    char hex[3];
+    snprintf(hex, sizeof(hex), "%02x", bits[i]);
+    path += hex;
   }
-  return 0;
+  path += ".symidx";
+  return path;
+}
+
+void symbol_resolver::seek_cu(lookup_cursor& cur, Dwarf_Addr addr)
+{
+  if(cur.cudie && dwarf_haspc(cur.cudie, addr - cur.cu_bias) > 0)
+    return;
+
+  free(cur.scopes);
+  cur.scopes = nullptr;
+  cur.nscopes = 0;
+
+  cur.cu_bias = 0;
+  cur.cudie = cur.mod ? dwfl_module_addrdie(cur.mod, addr, &cur.cu_bias) : nullptr;
+}
+
+// True if some DIE directly below DIE covers PC, so DIE is no longer the innermost scope for PC.
+static bool child_has_pc(Dwarf_Die* die, Dwarf_Addr pc)
+{
+  Dwarf_Die child;
+  if(dwarf_child(die, &child) != 0)
+    return false;
+
+  do
+  {
+    if(dwarf_haspc(&child, pc) > 0)
+      return true;
+  }
+  while(dwarf_siblingof(&child, &child) == 0);
+
+  return false;
+}
+
+bool symbol_resolver::seek_scopes(lookup_cursor& cur, Dwarf_Addr addr)
+{
+  seek_cu(cur, addr);
+  if(!cur.cudie)
+    return false;
+
+  // The scope chain of the previous address is still valid if its innermost scope covers this address
+  // and none of its children does.
+  stage_timer timer(m_stats, resolver_stage::scopes, cur.timed);
+  const Dwarf_Addr pc = addr - cur.cu_bias;
+  if(cur.nscopes > 0 && dwarf_haspc(&cur.scopes[0], pc) > 0 && !child_has_pc(&cur.scopes[0], pc))
+    return true;
+
+  timer.miss();
+  free(cur.scopes);
+  cur.scopes = nullptr;
+  cur.nscopes = dwarf_getscopes(cur.cudie, pc, &cur.scopes);
+  if(cur.nscopes <= 0)
+  {
+    free(cur.scopes);
+    cur.scopes = nullptr;
+    cur.nscopes = 0;
+    return false;
+  }
+
+  return true;
+}
+
+std::string_view symbol_resolver::symname(const char* name)
+{
+  // Not demangled: the name lives in the module's string tables, which we keep open.
+  if(!m_opts.demangle)
+    return name;
+
+  // DWARF names are keyed by their address in .debug_str, which stays mapped as long as m_dwfl.
+  {
+    std::shared_lock<std::shared_mutex> guard(m_demangled_lock);
+    auto it = m_demangled.find(name);
+    if(it != m_demangled.end())
+    {
+      m_stats.count(resolver_stage::demangle);
+      return it->second;
+    }
+  }
+
+  // Demangling is rare and slow next to reading the clock, so every one of them is timed.
+  stage_timer timer(m_stats, resolver_stage::demangle, true);
+  timer.miss();
+  std::string_view demangled = demangle(name, m_names);
+  std::unique_lock<std::shared_mutex> guard(m_demangled_lock);
+  return m_demangled.emplace(name, demangled).first->second;
+}
+
+std::string_view symbol_resolver::symname(const symbol_index* index, size_t i)
+{
+  if(!m_opts.demangle)
+    return index->name(i);
+
+  if(index->is_demangled(i))
+  {
+    m_stats.count(resolver_stage::demangle);
+    return index->demangled_name(i);
+  }
+
+  stage_timer timer(m_stats, resolver_stage::demangle, true);
+  timer.miss();
+  return index->demangled_name(i);
+}
+
+// Name of a DWARF function for an inline table. Names from the DWARF of m_dwfl can be kept as they
+// are, as it stays open; a prewarm thread closes its DWARF when done, so those are copied to m_names.
+std::string_view symbol_resolver::function_name(const char* name, bool copy_strings)
+{
+  if(!copy_strings)
+    return symname(name);
+
+  const std::string_view demangled = m_opts.demangle ? demangle(name, m_names) : std::string_view(name);
+  return demangled.data() == name ? m_names.intern(demangled) : demangled;
+}
+
+size_t symbol_resolver::names_memory_usage() const
+{
+  std::shared_lock<std::shared_mutex> guard(m_demangled_lock);
+  return m_names.memory_usage() + m_demangled.bucket_count() * sizeof(void*) +
+         m_demangled.size() * (sizeof(std::pair<const char* const, std::string_view>) + 2 * sizeof(void*));
+}
+
+size_t symbol_resolver::demangle_memory_usage() const
+{
+  size_t bytes = names_memory_usage();
+  for(const auto& m : m_modules)
+    if(const symbol_index* index = m->ready.load(std::memory_order_acquire))
+      bytes += index->demangle_memory_usage();
+
+  return bytes;
+}
+
+resolver_stats symbol_resolver::stats() const
+{
+  resolver_stats stats;
+  m_stats.snapshot(stats);
+  stats.cache = m_cache.get_stats();
+  stats.line_table_bytes = m_lines.memory_usage();
+  stats.inline_table_bytes = m_inlines.memory_usage();
+  stats.name_bytes = names_memory_usage();
+
+  for(const auto& m : m_modules)
+  {
+    resolver_stats::module& out = stats.modules.emplace_back();
+    out.file = m->file;
+    out.lo = m->lo;
+    out.hi = m->hi;
+    if(const symbol_index* index = m->ready.load(std::memory_order_acquire))
+    {
+      out.indexed = true;
+      out.mapped = index->is_mapped();
+      out.symbols = index->count();
+      out.index_bytes = index->memory_usage();
+      out.demangle_bytes = index->demangle_memory_usage();
+    }
+  }
+
+  return stats;
 }
 
 static const char* get_diename(Dwarf_Die* die)
@@ -173,490 +737,585 @@ static const char* get_diename(Dwarf_Die* die)
   return name;
 }
 
-bool symbol_resolver::print_dwarf_function(Dwfl_Module* mod, Dwarf_Addr addr)
+// Add the inlined subroutine die, and everything inlined into it, as a child of node parent.
+void symbol_resolver::add_inline(inline_table& table, Dwarf_Die* die, size_t parent, Dwarf_Files* files,
+                                 Dwarf_Die* cu, Dwarf_Addr bias, bool copy_strings)
 {
-  Dwarf_Addr bias = 0;
-  Dwarf_Die* cudie = dwfl_module_addrdie(mod, addr, &bias);
+  inline_frame f;
+  f.function = function_name(get_diename(die), copy_strings);
 
-  Dwarf_Die* scopes;
-  int nscopes = dwarf_getscopes(cudie, addr - bias, &scopes);
-  if(nscopes <= 0)
-    return false;
+  Dwarf_Word val;
+  Dwarf_Attribute attr;
+  const char* src = nullptr;
+  if(files && dwarf_formudata(dwarf_attr(die, DW_AT_call_file, &attr), &val) == 0)
+    src = dwarf_filesrc(files, val, nullptr, nullptr);
+  if(src)
+  {
+    resolved_frame site;
+    print_src(src, 0, 0, cu, site);
+    f.call_file = copy_strings ? m_names.intern(site.file) : site.file;
+  }
 
-  bool res = false;
-  for(int i = 0; i < nscopes; ++i)
-    switch(dwarf_tag(&scopes[i]))
-    {
-      case DW_TAG_subprogram:
-      {
-        const char* name = get_diename(&scopes[i]);
-        if(!name)
-          goto done;
-        //printf("%s%c", symname(name), pretty ? ' ' : '\n');
-        res = true;
-        goto done;
-      }
+  if(dwarf_formudata(dwarf_attr(die, DW_AT_call_line, &attr), &val) == 0)
+    f.call_line = val;
 
-      case DW_TAG_inlined_subroutine:
-      {
-        const char* name = get_diename(&scopes[i]);
-        if(!name)
-          goto done;
-
-        // When using --pretty-print we only show inlines on their own line.
-        // Just print the first subroutine name.
-        if(pretty)
-        {
-          //printf("%s ", symname(name));
-          res = true;
-          goto done;
-        }
-        else {
-          //printf("%s inlined", symname(name));
-        }
+  if(dwarf_formudata(dwarf_attr(die, DW_AT_call_column, &attr), &val) == 0)
+    f.call_column = val;
 
-        Dwarf_Files* files;
-        if(dwarf_getsrcfiles(cudie, &files, nullptr) == 0)
-        {
-          Dwarf_Attribute attr_mem;
-          Dwarf_Word val;
-          if(dwarf_formudata(dwarf_attr(&scopes[i],
-                          DW_AT_call_file,
-                          &attr_mem), &val) == 0)
-          {
-            const char* file = dwarf_filesrc(files, val, nullptr, nullptr);
-            unsigned int lineno = 0;
-            unsigned int colno = 0;
-            if(dwarf_formudata(dwarf_attr(&scopes[i], DW_AT_call_line, &attr_mem), &val) == 0)
-              lineno = val;
-            if(dwarf_formudata(dwarf_attr(&scopes[i], DW_AT_call_column, &attr_mem), &val) == 0)
-              colno = val;
-
-            const char* comp_dir = "";
-            const char* comp_dir_sep = "";
-
-            if(!file)
-              file = "???";
-            else if(only_basenames)
-              file = basename(file);
-            else if(use_comp_dir && file[0] != '/')
-            {
-              const char* const* dirs;
-              size_t ndirs;
-              if(dwarf_getsrcdirs(files, &dirs, &ndirs) == 0 && dirs[0] != nullptr)
-              {
-                comp_dir = dirs[0];
-                comp_dir_sep = "/";
-              }
-            }
-
-            if(lineno == 0) {
-              //printf(" from %s%s%s", comp_dir, comp_dir_sep, file);
-            }
-            else if(colno == 0) {
-              //printf(" at %s%s%s:%u", comp_dir, comp_dir_sep, file, lineno);
-            }
-            else {
-              //printf(" at %s%s%s:%u:%u", comp_dir, comp_dir_sep, file, lineno, colno);
-            }
-          }
-        }
-        //printf(" in ");
-        continue;
-      }
-    }
+  const size_t node = table.add_node(parent, f);
+  Dwarf_Addr base, lo, hi;
+  for(ptrdiff_t off = 0; (off = dwarf_ranges(die, off, &base, &lo, &hi)) > 0;)
+    table.add_range(node, lo + bias, hi + bias);
 
-done:
-  free(scopes);
-  return res;
+  add_inlines(table, die, node, files, cu, bias, copy_strings);
 }
 
-void symbol_resolver::print_addrsym(Dwfl_Module* mod, GElf_Addr addr, std::string& symbol)
+// Add the inlined subroutines nested in die, at any depth, as children of node parent.
+void symbol_resolver::add_inlines(inline_table& table, Dwarf_Die* die, size_t parent, Dwarf_Files* files,
+                                  Dwarf_Die* cu, Dwarf_Addr bias, bool copy_strings)
 {
-  GElf_Sym s;
-  GElf_Off off;
-  const char* name = dwfl_module_addrinfo(mod, addr, &off, &s, nullptr, nullptr, nullptr);
-  if(!name)
+  Dwarf_Die child;
+  if(dwarf_child(die, &child) != 0)
+    return;
+
+  do
   {
-    // No symbol name.  Get a section name instead.
-    int i = dwfl_module_relocate_address(mod, &addr);
-    if(i >= 0)
-      name = dwfl_module_relocation_info(mod, i, nullptr);
+    switch(dwarf_tag(&child))
+    {
+      case DW_TAG_subprogram:
+        // Nested functions get their own table.
+        break;
 
-    if(!name) {
-      //printf("??%c", pretty ? ' ': '\n');
-    }
-    else {
-      //printf("(%s)+%#" PRIx64 "%c", name, addr, pretty ? ' ' : '\n');
+      case DW_TAG_inlined_subroutine:
+        add_inline(table, &child, parent, files, cu, bias, copy_strings);
+        break;
+
+      default:
+        // Lexical blocks and the like, which can hold inlines too.
+        add_inlines(table, &child, parent, files, cu, bias, copy_strings);
+        break;
     }
   }
-  else
+  while(dwarf_siblingof(&child, &child) == 0);
+}
+
+// The addresses around addr, a biased address of mod, that libdw gives the same CU: the arange holding
+// addr, or else the gap between the aranges around it, within the module. covered tells which.
+static bool cu_range_around(Dwfl_Module* mod, Dwarf_Addr addr, Dwarf_Addr& lo, Dwarf_Addr& hi, bool& covered)
+{
+  Dwarf_Addr start, end;
+  if(!dwfl_module_info(mod, nullptr, &start, &end, nullptr, nullptr, nullptr, nullptr) || addr < start ||
+     addr >= end)
+    return false;
+  lo = start;
+  hi = end;
+  covered = false;
+
+  Dwarf_Addr bias;
+  Dwarf* dw = dwfl_module_getdwarf(mod, &bias);
+  Dwarf_Aranges* aranges;
+  size_t naranges;
+  if(!dw || dwarf_getaranges(dw, &aranges, &naranges) != 0)
+    return true;
+
+  // libdw sorts the aranges by address: find the last one starting at or below addr.
+  const Dwarf_Addr pc = addr - bias;
+  size_t first = 0, count = naranges;
+  while(count > 0)
   {
-    name = symname(name);
-    if(off == 0) {
-      symbol.assign(name);
-      //printf("%s", name);
-    }
-    else {
-      //printf("%s+%#" PRIx64 "", name, off);
+    const size_t half = count / 2;
+    Dwarf_Addr a;
+    if(dwarf_getarangeinfo(dwarf_onearange(aranges, first + half), &a, nullptr, nullptr) != 0)
+      return false;
+    if(a <= pc)
+    {
+      first += half + 1;
+      count -= half + 1;
     }
+    else
+      count = half;
+  }
 
-    // Also show section name for address.
-    if(show_symbol_sections)
+  Dwarf_Addr a;
+  Dwarf_Word length;
+  if(first < naranges)
+  {
+    if(dwarf_getarangeinfo(dwarf_onearange(aranges, first), &a, nullptr, nullptr) != 0)
+      return false;
+    hi = std::min(hi, a + bias);
+  }
+  if(first > 0)
+  {
+    if(dwarf_getarangeinfo(dwarf_onearange(aranges, first - 1), &a, &length, nullptr) != 0)
+      return false;
+    if(pc < a + length)
     {
-      Dwarf_Addr ebias;
-      Elf_Scn* scn = dwfl_module_address_section(mod, &addr, &ebias);
-      if(scn)
-      {
-        GElf_Shdr shdr_mem;
-        GElf_Shdr* shdr = gelf_getshdr(scn, &shdr_mem);
-        if(shdr)
-        {
-          Elf* elf = dwfl_module_getelf(mod, &ebias);
-          size_t shstrndx;
-          if(elf_getshdrstrndx(elf, &shstrndx) >= 0) {
-            //printf(" (%s)", elf_strptr(elf, shstrndx, shdr->sh_name));
-          }
-        }
-      }
+      covered = true;
+      lo = std::max(lo, a + bias);
+      hi = std::min(end, a + length + bias);
     }
-    //printf("%c", pretty ? ' ' : '\n');
+    else
+      lo = std::max(lo, a + length + bias);
   }
+  return lo <= addr && addr < hi;
 }
 
-static int see_one_module(Dwfl_Module* mod,
-                          void** userdata,
-                          const char* name,
-                          Dwarf_Addr start,
-                          void* arg)
+const line_table* symbol_resolver::cu_lines(lookup_cursor& cur, Dwarf_Addr addr, stage_timer& timer)
 {
-  auto result = reinterpret_cast<Dwfl_Module**>(arg);
-  if(*result)
-    return DWARF_CB_ABORT;
-  *result = mod;
-  return DWARF_CB_OK;
+  const line_table* known;
+  if(m_lines.find(addr, known) && known)
+    return known;
+
+  // Not in a known sequence, or in one shared by several CUs: let libdw choose the CU.
+  std::lock_guard<std::mutex> guard(m_dwfl_lock);
+  seek_cu(cur, addr);
+  const line_table* table = nullptr;
+  if(cur.cudie)
+  {
+    const uint64_t cu = dwarf_dieoffset(cur.cudie);
+    table = m_lines.cu_table(cu);
+    if(!table)
+    {
+      // First address in this CU: flatten its whole line program.
+      timer.miss();
+      table = m_lines.insert(cu, build_lines(cur.cudie, cur.cu_bias, false));
+    }
+  }
+
+  // Remember addresses without a line too, those of the CU outside its sequences and those outside
+  // every CU, the way function_inlines() remembers code without DWARF, so they find no line without
+  // taking the lock again.
+  line_table::line l;
+  Dwarf_Addr lo, hi;
+  bool covered;
+  if(cur.mod && !(table && table->find(addr, l)) && cu_range_around(cur.mod, addr, lo, hi, covered) &&
+     covered == (table != nullptr))
+    m_lines.insert_range(lo, hi, table);
+  return table;
 }
 
-static int find_symbol(Dwfl_Module* mod, void** userdata, const char* name, Dwarf_Addr start, void* arg)
+// Line table of the CU, with addresses moved by bias. With copy_strings the file names are copied to
+// m_names instead of pointing into the CU's DWARF.
+std::unique_ptr<line_table> symbol_resolver::build_lines(Dwarf_Die* cu, Dwarf_Addr bias, bool copy_strings)
 {
-  auto looking_for = reinterpret_cast<const char*>(((void**) arg)[0]);
-  auto symbol = reinterpret_cast<GElf_Sym*>(((void**) arg)[1]);
-  auto value = reinterpret_cast<GElf_Addr*>(((void**) arg)[2]);
-
-  int n = dwfl_module_getsymtab(mod);
-  for(int i = 1; i < n; ++i)
+  Dwarf_Lines* lines;
+  size_t nlines;
+  if(dwarf_getsrclines(cu, &lines, &nlines) != 0)
+    nlines = 0;
+
+  // File names are resolved once, by their entry in the CU's file table.
+  auto table = std::make_unique<line_table>();
+  std::unordered_map<const char*, uint32_t> files;
+  for(size_t i = 0; i < nlines; ++i)
   {
-    const char* symbol_name =
-      dwfl_module_getsym_info(mod, i, symbol, value, nullptr, nullptr, nullptr);
+    Dwarf_Line* line = dwarf_onesrcline(lines, i);
+    Dwarf_Addr line_addr;
+    if(!line || dwarf_lineaddr(line, &line_addr) != 0)
+      continue;
+    line_addr += bias;
 
-    if(!symbol_name || symbol_name[0] == '\0')
+    bool end = false;
+    dwarf_lineendsequence(line, &end);
+    if(end)
+    {
+      table->add_end_sequence(line_addr);
       continue;
+    }
 
-    switch(GELF_ST_TYPE(symbol->st_info))
+    const char* src = dwarf_linesrc(line, nullptr, nullptr);
+    int lineno = 0, linecol = 0;
+    dwarf_lineno(line, &lineno);
+    dwarf_linecol(line, &linecol);
+    if(!src)
     {
-    case STT_SECTION:
-    case STT_FILE:
-    case STT_TLS:
-      break;
-    default:
-      if(!strcmp(symbol_name, looking_for))
-        {
-          ((void**)arg)[0] = nullptr;
-          return DWARF_CB_ABORT;
-        }
+      table->add_end_sequence(line_addr);
+      continue;
+    }
+
+    auto it = files.find(src);
+    if(it == files.end())
+    {
+      resolved_frame f;
+      print_src(src, 0, 0, cu, f);
+      it = files.emplace(src, table->add_file(copy_strings ? m_names.intern(f.file) : f.file)).first;
     }
+    table->add_row(line_addr, it->second, lineno, linecol);
   }
 
-  return DWARF_CB_OK;
+  std::vector<line_table::range> cu_ranges;
+  Dwarf_Addr base, lo, hi;
+  for(ptrdiff_t off = 0; (off = dwarf_ranges(cu, off, &base, &lo, &hi)) > 0;)
+    cu_ranges.push_back({ lo + bias, hi + bias });
+  if(!cu_ranges.empty())
+    table->clip_sequences(std::move(cu_ranges));
+
+  return table;
 }
 
-bool symbol_resolver::adjust_to_section(const char* name, uintmax_t* addr)
+const inline_table* symbol_resolver::function_inlines(lookup_cursor& cur, Dwarf_Addr addr, stage_timer& timer)
 {
-  // It was (section)+offset.  This makes sense if there is only one module to look in for a section.
-  Dwfl_Module* mod = nullptr;
-  if(dwfl_getmodules(m_dwfl, &see_one_module, &mod, 0) != 0 || !mod)
-    throw std::runtime_error("Section syntax requires exactly one module");
+  if(const inline_table* table = m_inlines.find(addr))
+    return table;
+
+  timer.miss();
+  // Remember code without DWARF too, as an empty table over its symbol or just over addr.
+  auto no_inlines = [&]() {
+    auto table = std::make_unique<inline_table>();
+    if(cur.sym_name && addr >= cur.sym_lo && addr < cur.sym_hi)
+      table->add_function_range(cur.sym_lo, cur.sym_hi);
+    else
+      table->add_function_range(addr, addr + 1);
+    table->finish();
+    return m_inlines.insert(std::move(table));
+  };
+
+  // First address in this CU: build the tables of all its functions in one walk of its DIEs, as the
+  // prewarm does, rather than searching the CU for the scopes of each function in turn.
+  std::lock_guard<std::mutex> guard(m_dwfl_lock);
+  seek_cu(cur, addr);
+  if(cur.cudie && m_inline_cus.insert(dwarf_dieoffset(cur.cudie)).second)
+  {
+    prewarm_functions(cur.cudie, cur.cudie, cur.cu_bias, false);
+    if(const inline_table* table = m_inlines.find(addr))
+      return table;
+  }
 
-  int nscn = dwfl_module_relocations(mod);
-  for(int i = 0; i < nscn; ++i)
+  // Code the walk does not reach, such as nested functions or split-off parts with their inlined code
+  // directly in the CU: walk the DIE tree of the function around addr.
+  if(!seek_scopes(cur, addr))
+    return no_inlines();
+
+  // dwarf_getscopes continues from an inlined subroutine into the scopes of its abstract definition;
+  // the DIEs physically enclosing the innermost scope lead to the function the code is in. Split-off
+  // parts of a function, such as .cold blocks, can have their inlined code directly in the CU; then
+  // the outermost scope below the CU stands in for the function.
+  Dwarf_Die* parents = nullptr;
+  const int nparents = dwarf_getscopes_die(&cur.scopes[0], &parents);
+  Dwarf_Die* function = nullptr;
+  for(int i = 0; i < nparents && !function; ++i)
+    if(dwarf_tag(&parents[i]) == DW_TAG_subprogram)
+      function = &parents[i];
+  if(!function && nparents > 1)
+    function = &parents[nparents - 2];
+  if(!function)
   {
-    GElf_Word shndx;
-    const char* scn = dwfl_module_relocation_info(mod, i, &shndx);
-    if(!scn) // [[unlikely]]
-      break;
-    if(!strcmp(scn, name))
-    {
-      // Found the section.
-      GElf_Shdr shdr_mem;
-      GElf_Addr shdr_bias;
-      GElf_Shdr* shdr = gelf_getshdr(elf_getscn(dwfl_module_getelf(mod, &shdr_bias), shndx), &shdr_mem);
-      if(!shdr) // [[unlikely]]
-        break;
+    free(parents);
+    return no_inlines();
+  }
 
-      if(*addr >= shdr->sh_size) {
-        char str[100];
-        sprintf(str, "offset %#" PRIxMAX " lies outside section '%s'", *addr, scn);
-        throw std::runtime_error(str);
-      }
+  auto table = build_inlines(function, cur.cudie, cur.cu_bias, false);
+  free(parents);
+  if(!table)
+    return no_inlines();
+  return m_inlines.insert(std::move(table));
+}
 
-      *addr += shdr->sh_addr + shdr_bias;
-      return true;
-    }
-  }
+// Inline table of function, a subprogram or a stand-in for one, with addresses moved by bias; nullptr
+// if the function has no code. With copy_strings the names are copied to m_names instead of pointing
+// into the CU's DWARF.
+std::unique_ptr<inline_table> symbol_resolver::build_inlines(Dwarf_Die* function, Dwarf_Die* cu, Dwarf_Addr bias,
+                                                             bool copy_strings)
+{
+  auto table = std::make_unique<inline_table>();
+  table->set_function(function_name(get_diename(function), copy_strings));
 
-  return false;
+  Dwarf_Addr base, lo, hi;
+  for(ptrdiff_t off = 0; (off = dwarf_ranges(function, off, &base, &lo, &hi)) > 0;)
+    table->add_function_range(lo + bias, hi + bias);
+  if(table->function_ranges().empty())
+    return nullptr;
+
+  Dwarf_Files* files = nullptr;
+  if(dwarf_getsrcfiles(cu, &files, nullptr) != 0)
+    files = nullptr;
+
+  if(dwarf_tag(function) == DW_TAG_inlined_subroutine)
+    add_inline(*table, function, inline_table::npos, files, cu, bias, copy_strings);
+  else
+    add_inlines(*table, function, inline_table::npos, files, cu, bias, copy_strings);
+  table->finish();
+  return table;
 }
 
-static void print_src(const char* src, int lineno, int linecol, Dwarf_Die* cu)
+void symbol_resolver::print_addrsym(lookup_cursor& cur, GElf_Addr addr, resolved_frame& frame)
 {
-  const char* comp_dir = "";
-  const char* comp_dir_sep = "";
+  stage_timer timer(m_stats, resolver_stage::symbol, cur.timed);
+  Dwfl_Module* mod = cur.mod;
+  const char* name;
+  GElf_Off off;
+  if(cur.sym_name && addr >= cur.sym_lo && addr < cur.sym_hi)
+  {
+    // Same symbol as the previous address.
+    name = cur.sym_name;
+    off = addr - cur.sym_lo;
+  }
+  else
+  {
+    timer.miss();
+    const size_t i = cur.index ? cur.index->find(addr) : symbol_index::npos;
+    if(i != symbol_index::npos)
+    {
+      name = cur.index->name(i);
+      cur.sym_index = i;
+      cur.sym_lo = cur.index->start(i);
+      cur.sym_hi = cur.sym_lo + cur.index->size(i);
+      off = addr - cur.sym_lo;
+    }
+    else
+    {
+      name = nullptr;
+      off = 0;
+      cur.sym_lo = cur.sym_hi = 0;
+    }
+    cur.sym_name = name;
+  }
 
-  if(only_basenames)
-    src = basename(src);
-  else if(use_comp_dir && src[0] != '/')
+  if(!name)
   {
-    Dwarf_Attribute attr;
-    comp_dir = dwarf_formstring(dwarf_attr(cu, DW_AT_comp_dir, &attr));
-    if(comp_dir)
-      comp_dir_sep = "/";
+    // libdwfl gives addresses in a shared object as an offset in its only relocation base, an unnamed
+    // section. Executables are not relocatable and get no section.
+    if(m_elf)
+    {
+      if(cur.index && m_elf->type() == ET_DYN)
+        frame.offset = addr - cur.mod_lo;
+      return;
+    }
+    if(!mod)
+      return;
+
+    // No symbol name.  Get a section name instead.
+    std::lock_guard<std::mutex> guard(m_dwfl_lock);
+    int i = dwfl_module_relocate_address(mod, &addr);
+    if(i >= 0)
+      name = dwfl_module_relocation_info(mod, i, nullptr);
+
+    if(name)
+    {
+      // (section)+offset
+      frame.section = name;
+      frame.offset = addr;
+    }
   }
+  else
+  {
+    frame.name = symname(cur.index, cur.sym_index);
+    frame.offset = off;
 
-  if(linecol != 0) {
-    //printf("%s%s%s:%d:%d", comp_dir, comp_dir_sep, src, lineno, linecol);
+    // Also show section name for address.
+    if(m_opts.show_symbol_sections)
+    {
+      const char* section = cur.index->section_name(addr);
+      if(section)
+        frame.section = section;
+    }
   }
-  else {
-    //printf("%s%s%s:%d", comp_dir, comp_dir_sep, src, lineno);
+}
+
+bool symbol_resolver::adjust_to_section(std::string_view name, uintmax_t* addr)
+{
+  // It was (section)+offset.  This makes sense if there is only one module to look in for a section.
+  if(m_modules.size() != 1)
+    throw std::runtime_error("Section syntax requires exactly one module");
+
+  const symbol_index::section_range* scn = module_index(*m_modules[0])->find_section(name);
+  if(!scn)
+    return false;
+
+  if(*addr >= scn->size) {
+    char str[100];
+    snprintf(str, sizeof(str), "offset %#" PRIxMAX " lies outside section '%.*s'", *addr, int(name.size()),
+             name.data());
+    throw std::runtime_error(str);
   }
+
+  *addr += scn->addr;
+  return true;
 }
 
-static int get_addr_width(Dwfl_Module* mod)
+void symbol_resolver::print_src(const char* src, int lineno, int linecol, Dwarf_Die* cu, resolved_frame& frame)
 {
-  // Try to find the address width if possible.
-  static int width = 0;
-  if(width == 0 && mod != nullptr)
+  frame.line = lineno;
+  frame.column = linecol;
+
+  if(m_opts.only_basenames)
+    frame.file = basename(src);
+  else if(m_opts.use_comp_dir && src[0] != '/')
   {
-    Dwarf_Addr bias;
-    Elf* elf = dwfl_module_getelf(mod, &bias);
-    if(elf != nullptr)
+    Dwarf_Attribute attr;
+    const char* comp_dir = dwarf_formstring(dwarf_attr(cu, DW_AT_comp_dir, &attr));
+    if(comp_dir)
     {
-      GElf_Ehdr ehdr_mem;
-      GElf_Ehdr* ehdr = gelf_getehdr(elf, &ehdr_mem);
-      if(ehdr != nullptr)
-        width = ehdr->e_ident[EI_CLASS] == ELFCLASS32 ? 8 : 16;
+      std::string& path = t_scratch.path;
+      path.assign(comp_dir);
+      path += '/';
+      path += src;
+      frame.file = m_names.intern(path);
     }
+    else
+      frame.file = src;
   }
-  if(width == 0)
-    width = 16;
+  else
+    frame.file = src;
+}
 
-  return width;
+int symbol_resolver::resolve(const char* address, resolved_frame& frame)
+{
+  frame = {};
+  return frame.status = handle_address(address, frame);
 }
 
-static inline void show_note(int (*get)(Dwarf_Line*, bool*), Dwarf_Line* info, const char* note)
+int symbol_resolver::handle_address(const char* addr_str, resolved_frame& frame)
 {
-  bool flag;
-  if((*get)(info, &flag) == 0 && flag) {
-    //fputs(note, stdout);
+  // One sample decision covers the parse and the lookup that follows it.
+  lookup_cursor cur;
+  cur.timed = m_stats.sample();
+
+  uintmax_t addr;
+  {
+    stage_timer timer(m_stats, resolver_stage::parse, cur.timed);
+    if(parse_address(addr_str, addr) != 0)
+      return 1;
   }
+
+  frame.address = addr;
+  return resolve_address(addr, m_opts.level, cur, frame);
 }
 
-static inline void show_int(int(*get)(Dwarf_Line*, unsigned int*), Dwarf_Line* info, const char* name)
+// A whole string holding an integer the way sscanf's %i reads it: signed, in decimal, octal or hex.
+static bool parse_offset(const char* str, uintmax_t& value)
 {
-  unsigned int val;
-  if((*get)(info, &val) == 0 && val != 0) {
-    //printf(" (%s %u)", name, val);
-  }
+  char* endp;
+  value = strtoimax(str, &endp, 0);
+  return endp != str && *endp == '\0';
 }
 
-int symbol_resolver::handle_address(const char* addr_str, std::string& symbol)
+int symbol_resolver::parse_address(const char* addr_str, uintmax_t& addr)
 {
   char* endp;
-  uintmax_t addr = strtoumax(addr_str, &endp, 16);
+  addr = strtoumax(addr_str, &endp, 16);
   if(endp == addr_str || *endp != '\0')
   {
+    // The names are taken as views of addr_str, so that parsing allocates nothing.
     bool parsed = false;
-    int i, j;
-    char* name = nullptr;
 
-    if(sscanf(addr_str, "(%m[^)])%" PRIiMAX "%n", &name, &addr, &i) == 2 && addr_str[i] == '\0')
-      parsed = adjust_to_section(name, &addr);
+    // (section)offset
+    const char* close = addr_str[0] == '(' ? strchr(addr_str, ')') : nullptr;
+    if(close && close > addr_str + 1 && parse_offset(close + 1, addr))
+      parsed = adjust_to_section(std::string_view(addr_str + 1, close - addr_str - 1), &addr);
 
-    switch(sscanf(addr_str, "%m[^-+]%n%" PRIiMAX "%n", &name, &i, &addr, &j))
+    // symbol[+offset]
+    const size_t len = strcspn(addr_str, "+-");
+    if(!parsed && len > 0 && (addr_str[len] == '\0' ? (addr = 0, true) : parse_offset(addr_str + len, addr)))
     {
-    default:
-      break;
-    case 1:
-      addr = 0;
-      j = i;
-      //[[fallthrough]]
-    case 2:
-      if(addr_str[j] != '\0')
-        break;
+      const std::string_view name(addr_str, len);
+      const symbol_index::named_symbol* sym = nullptr;
+      for(auto& m : m_modules)
+        if((sym = module_index(*m)->find_name(name)))
+          break;
 
-      // It was symbol[+offset].
-      GElf_Sym sym;
-      GElf_Addr value = 0;
-      void* arg[3] = { name, &sym, &value };
-      dwfl_getmodules(m_dwfl, &find_symbol, arg, 0);
-      if(arg[0]) {
+      if(!sym) {
         char str[100];
-        sprintf(str, "cannot find symbol '%s'", name);
+        snprintf(str, sizeof(str), "cannot find symbol '%.*s'", int(name.size()), name.data());
         throw std::runtime_error(str);
       }
       else
       {
-        if(sym.st_size != 0 && addr >= sym.st_size) {
+        if(sym->size != 0 && addr >= sym->size) {
           char str[100];
-          sprintf(str, "offset %#" PRIxMAX " lies outside contents of '%s'", addr, name);
+          snprintf(str, sizeof(str), "offset %#" PRIxMAX " lies outside contents of '%.*s'", addr, int(name.size()),
+                   name.data());
           throw std::runtime_error(str);
         }
-        addr += value;
+        addr += sym->value;
         parsed = true;
       }
-      break;
     }
 
-    free(name);
     if(!parsed)
       return 1;
   }
-  else if(just_section && !adjust_to_section(just_section, &addr))
+  else if(!m_opts.just_section.empty() && !adjust_to_section(m_opts.just_section, &addr))
     return 1;
 
-  Dwfl_Module* mod = dwfl_addrmodule(m_dwfl, addr);
+  return 0;
+}
 
-  if(print_addresses)
+int symbol_resolver::resolve_address(uintmax_t addr, resolve_level level, lookup_cursor& cur, resolved_frame& frame)
+{
+  if(m_opts.symbols_only)
+    level = resolve_level::symbols;
+
+  stage_timer timer(m_stats, resolver_stage::total, cur.timed);
+  seek_module(cur, addr);
+
+  // The symbol index and the cache are safe to search concurrently.
+  frame_cache::entry cached;
+  const bool hit = m_cache.lookup(addr, cached);
+  if(!hit)
+    timer.miss();
+  if(hit)
   {
-    int width = get_addr_width(mod);
-    //printf("0x%.*" PRIx64 "%s", width, addr, pretty ? ": " : "\n");
+    frame.name = cached.name;
+    frame.offset = addr - cached.lo;
+    frame.section = cached.section;
   }
-
-  if(show_functions)
+  else if(m_opts.show_symbols)
+    print_addrsym(cur, addr, frame);
+
+  // The inline chain, for the depth and for the function name if no ELF symbol covers the address.
+  // On a cache hit only code that may have inlines needs it.
+  const inline_table* inlines = nullptr;
+  std::span<const inline_frame> chain;
+  if(level >= resolve_level::inlines && (m_opts.show_functions || m_opts.show_inlines) &&
+     (!hit || cached.has_inlines))
   {
-    // First determine the function name.  Use the DWARF information if possible.
-    if(!print_dwarf_function(mod, addr) && !show_symbols)
+    stage_timer inline_timer(m_stats, resolver_stage::inlines, cur.timed);
+    if((inlines = function_inlines(cur, addr, inline_timer)) != nullptr)
     {
-      const char* name = dwfl_module_addrname(mod, addr);
-      name = name ? symname(name) : "??";
-      symbol.assign(name);
-      //printf("%s%c", name, pretty ? ' ' : '\n');
+      chain = inlines->chain(addr);
+      frame.inline_depth = chain.size();
+      if(m_opts.show_inlines)
+        frame.inlines = chain;
     }
   }
 
-  if(show_symbols)
-    print_addrsym(mod, addr, symbol);
-
-  if((show_functions || show_symbols) && pretty) {
-    //printf("at ");
-  }
-
-  Dwfl_Line* line = dwfl_module_getsrc(mod, addr);
-
-  const char* src;
-  int lineno, linecol;
-
-  if(line && (src = dwfl_lineinfo(line, &addr, &lineno, &linecol, nullptr, nullptr)) != nullptr)
+  if(!hit)
   {
-    print_src(src, lineno, linecol, dwfl_linecu(line));
-    if(show_flags)
+    const std::string_view function = !inlines ? std::string_view() : chain.empty() ? inlines->function() : chain[0].function;
+    if(frame.name.empty() && m_opts.show_functions && !function.empty())
+      frame.name = function;
+    else if(frame.name.empty() && m_opts.show_functions && !m_opts.show_symbols)
     {
-      Dwarf_Addr bias;
-      Dwarf_Line* info = dwfl_dwarf_line(line, &bias);
-      assert(info);
-
-      show_note(&dwarf_linebeginstatement, info, " (is_stmt)");
-      show_note(&dwarf_lineblock, info, " (basic_block)");
-      show_note(&dwarf_lineprologueend, info, " (prologue_end)");
-      show_note(&dwarf_lineepiloguebegin, info, " (epilogue_begin)");
-      show_int(&dwarf_lineisa, info, "isa");
-      show_int(&dwarf_linediscriminator, info, "discriminator");
+      const size_t i = cur.index ? cur.index->find(addr) : symbol_index::npos;
+      if(i != symbol_index::npos)
+        frame.name = symname(cur.index, i);
     }
-    //putchar('\n');
-  }
-  else {
-    //puts("??:0");
-  }
-
-  if(show_inlines)
-  {
-    Dwarf_Addr bias = 0;
-    Dwarf_Die* cudie = dwfl_module_addrdie(mod, addr, &bias);
-
-    Dwarf_Die* scopes = nullptr;
-    int nscopes = dwarf_getscopes(cudie, addr - bias, &scopes);
-    if(nscopes < 0)
-      return 1;
 
-    if(nscopes > 0)
+    // Remember the whole symbol, so that other addresses in it skip straight to the line lookup.
+    if(m_opts.show_symbols && !frame.name.empty() && cur.sym_name && addr >= cur.sym_lo && addr < cur.sym_hi)
     {
-      Dwarf_Die subroutine;
-      Dwarf_Off dieoff = dwarf_dieoffset(&scopes[0]);
-      dwarf_offdie(dwfl_module_getdwarf(mod, &bias), dieoff, &subroutine);
-      free(scopes);
-      scopes = nullptr;
-
-      nscopes = dwarf_getscopes_die(&subroutine, &scopes);
-      if(nscopes > 1)
-      {
-        Dwarf_Die cu;
-        Dwarf_Files* files;
-        if(dwarf_diecu(&scopes[0], &cu, nullptr, nullptr)
-           && dwarf_getsrcfiles(cudie, &files, nullptr) == 0)
-        {
-          for(int i = 0; i < nscopes - 1; i++)
-          {
-            Dwarf_Word val;
-            Dwarf_Attribute attr;
-            Dwarf_Die* die = &scopes[i];
-            if(dwarf_tag(die) != DW_TAG_inlined_subroutine)
-              continue;
-
-            if(pretty) {
-              //printf(" (inlined by) ");
-            }
-
-            if(show_functions)
-            {
-              // Search for the parent inline or function. It might not be directly above this inline
-              // -- e.g. there could be a lexical_block in between.
-              for(int j = i + 1; j < nscopes; j++)
-              {
-                Dwarf_Die* parent = &scopes[j];
-                int tag = dwarf_tag(parent);
-                if(tag == DW_TAG_inlined_subroutine || tag == DW_TAG_entry_point || tag == DW_TAG_subprogram)
-                {
-                  //printf("%s%s", symname(get_diename(parent)), pretty ? " at " : "\n");
-                  break;
-                }
-              }
-            }
-
-            src = nullptr;
-            lineno = 0;
-            linecol = 0;
-            if(dwarf_formudata(dwarf_attr(die, DW_AT_call_file, &attr), &val) == 0)
-              src = dwarf_filesrc(files, val, nullptr, nullptr);
-
-            if(dwarf_formudata(dwarf_attr(die, DW_AT_call_line, &attr), &val) == 0)
-              lineno = val;
-
-            if(dwarf_formudata(dwarf_attr(die, DW_AT_call_column, &attr), &val) == 0)
-              linecol = val;
-
-            if(src)
-            {
-              print_src(src, lineno, linecol, &cu);
-              //putchar('\n');
-            }
-            else {
-              //puts("??:0");
-            }
-          }
-        }
-      }
+      frame_cache::entry e;
+      e.lo = cur.sym_lo;
+      e.hi = cur.sym_hi;
+      e.name = frame.name;
+      e.section = frame.section;
+      e.has_inlines = !inlines || !inlines->empty(); // not known yet below the inlines level
+      m_cache.insert(addr, e);
     }
-    free(scopes);
   }
 
-  return 0;
+  if(level < resolve_level::lines)
+    return frame.name.empty() ? 1 : 0;
+
+  stage_timer line_timer(m_stats, resolver_stage::lines, cur.timed);
+  line_table::line l;
+  const line_table* lines = cu_lines(cur, addr, line_timer);
+  if(lines && lines->find(addr, l))
+  {
+    frame.file = l.file;
+    frame.line = l.line;
+    frame.column = l.column;
+  }
+
+  return frame.name.empty() && frame.file.empty() ? 1 : 0;
 }
@@ -2,11 +2,31 @@
 
 #pragma once
 
+#include "elf_image.h"
+#include "frame_cache.h"
+#include "inline_table.h"
+#include "line_table.h"
+#include "resolver_backend.h"
+#include "resolver_stats.h"
+#include "string_pool.h"
+#include "symbol_index.h"
+
 #include <dwarf.h>
 #include <libdwfl.h>
 
+#include <atomic>
 #include <cinttypes>
+#include <condition_variable>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <span>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 //int resolve_symbols(const std::string& fname, const std::vector<uintptr_t>& addrs);
@@ -14,22 +34,181 @@
 struct Dwfl;
 struct Dwfl_Module;
 
-class symbol_resolver
+// Resolves addresses of one ELF file with elfutils. All lookups may be called concurrently from any
+// number of threads: per-module indexes are built once and then only read, and the remaining libdw
+// work is serialized internally.
+//
+// With prewarm_threads, the constructor returns at once and background threads build what lookups
+// would otherwise build one CU and one function at a time: the symbol index of every module, the line
+// table of every CU and the inline table of every function. Each thread reads the DWARF through a
+// libdw handle of its own, so they do not wait for each other or for the lookups, which are served
+// all along and use whatever is ready.
+//
+// Separate debug files are searched in debug_dirs first, then where libdwfl looks by default. With a
+// debug_cache, debug files with compressed sections are read from the decompressed copy it keeps.
+class symbol_resolver final : public resolver_backend
 {
 public:
-  symbol_resolver(const std::string& fname);
-  ~symbol_resolver();
+  using options = resolver_options;
+
+  explicit symbol_resolver(const std::string& fname);
+  symbol_resolver(const std::string& fname, const options& opts);
+  ~symbol_resolver() override;
+
+  symbol_resolver(const symbol_resolver&) = delete;
+  symbol_resolver& operator=(const symbol_resolver&) = delete;
+
+  const char* name() const override { return "elfutils"; }
+
+  // Returns 0 if the address got a name, or at resolve_level::lines and above a source line, and
+  // non-zero if it resolved to nothing, as outside every module or in code without symbols.
+  int resolve(uintptr_t addr, resolved_frame& frame);
+  int resolve(uintptr_t addr, resolved_frame& frame, resolve_level level) override;
 
+  // Resolve an address given as text: hex, symbol[+offset] or (section)+offset, like addr2line.
+  // Throws std::runtime_error if a named symbol or section does not contain the offset.
+  int resolve(const char* address, resolved_frame& frame);
+
+  // Only sets symbol when addr is the exact start of a symbol.
   int resolve(uintptr_t addrs, std::string& symbol);
 
+  // Resolve many addresses at once. results[i] receives the resolution of addrs[i]; the addresses are
+  // sorted and deduplicated internally so module, CU and scope lookups are shared between neighbours.
+  // Returns the number of addresses that failed to resolve.
+  size_t resolve_batch(std::span<const uintptr_t> addrs, std::span<resolved_frame> results);
+  size_t resolve_batch(std::span<const uintptr_t> addrs, std::span<resolved_frame> results,
+                       resolve_level level) override;
+
+  // Wait for the prewarm started by the constructor to finish; returns at once without one.
+  void wait_prewarm();
+
+  // Whether every table has been built by the prewarm, false without one.
+  bool prewarmed() const { return m_prewarmed.load(std::memory_order_acquire); }
+
+  frame_cache::stats cache_stats() const { return m_cache.get_stats(); }
+
+  // Snapshot of the stage counters and latencies, the cache hit rates and the memory held, per module
+  // and in the shared tables. Cheap enough to poll; concurrent lookups may be partly counted.
+  resolver_stats stats() const;
+
+  // Bytes held by demangled names and the tables mapping mangled names to them.
+  size_t demangle_memory_usage() const;
+
+  // Build-id of the file as raw bytes, empty if it has none.
+  const std::string& build_id() const { return m_build_id; }
+
+  // Link-time address of the byte at file offset, taken from the PT_LOAD segment that contains it.
+  // Returns false if no loadable segment covers offset.
+  bool file_offset_address(uint64_t offset, uintptr_t& addr);
+
 private:
-  int handle_address(const char* string, std::string& symbol);
-  const char* symname(const char* name);
-  bool print_dwarf_function(Dwfl_Module* mod, Dwarf_Addr addr);
-  void print_addrsym(Dwfl_Module* mod, GElf_Addr addr, std::string& symbol);
-  bool adjust_to_section(const char* name, uintmax_t* addr);
+  // A module of m_dwfl with its address range. The symbol index is built by the first lookup that
+  // lands in the module and is immutable afterwards.
+  struct module_entry
+  {
+    Dwfl_Module* mod = nullptr; // nullptr for the file of m_elf
+    std::string file;
+    Dwarf_Addr lo = 0;
+    Dwarf_Addr hi = 0;
+    std::once_flag index_once;
+    std::unique_ptr<symbol_index> index;
+    std::atomic<const symbol_index*> ready{ nullptr }; // index, once built, for readers outside index_once
+  };
+
+  // Module, CU, scope and symbol state carried from one address to the next. A fresh cursor is used
+  // for a single lookup, resolve_batch() keeps one alive while walking the sorted addresses.
+  struct lookup_cursor
+  {
+    Dwfl_Module* mod = nullptr;
+    Dwarf_Addr mod_lo = 0;
+    Dwarf_Addr mod_hi = 0;
+    const symbol_index* index = nullptr;
+
+    Dwarf_Die* cudie = nullptr;
+    Dwarf_Addr cu_bias = 0;
+
+    Dwarf_Die* scopes = nullptr; // owned, from dwarf_getscopes
+    int nscopes = 0;
+
+    const char* sym_name = nullptr; // symbol covering [sym_lo, sym_hi)
+    size_t sym_index = 0;           // its slot in index
+    GElf_Addr sym_lo = 0;
+    GElf_Addr sym_hi = 0;
+
+    bool timed = false; // the stages of the current address are timed, sampled once per address by the caller
 
+    ~lookup_cursor() { free(scopes); }
+  };
+
+  int handle_address(const char* string, resolved_frame& frame);
+  int parse_address(const char* string, uintmax_t& addr);
+  int resolve_address(uintmax_t addr, resolve_level level, lookup_cursor& cur, resolved_frame& frame);
+  void seek_module(lookup_cursor& cur, Dwarf_Addr addr);
+  module_entry* find_module(Dwarf_Addr addr) const;
+  const symbol_index* module_index(module_entry& m, bool* built = nullptr);
+  std::string index_path(const module_entry& m) const;
+  void seek_cu(lookup_cursor& cur, Dwarf_Addr addr);
+  bool seek_scopes(lookup_cursor& cur, Dwarf_Addr addr);
+  std::string_view symname(const char* name);
+  std::string_view symname(const symbol_index* index, size_t i);
+  const line_table* cu_lines(lookup_cursor& cur, Dwarf_Addr addr, stage_timer& timer);
+  const inline_table* function_inlines(lookup_cursor& cur, Dwarf_Addr addr, stage_timer& timer);
+  std::unique_ptr<line_table> build_lines(Dwarf_Die* cu, Dwarf_Addr bias, bool copy_strings);
+  std::unique_ptr<inline_table> build_inlines(Dwarf_Die* function, Dwarf_Die* cu, Dwarf_Addr bias,
+                                              bool copy_strings);
+  void add_inline(inline_table& table, Dwarf_Die* die, size_t parent, Dwarf_Files* files, Dwarf_Die* cu,
+                  Dwarf_Addr bias, bool copy_strings);
+  void add_inlines(inline_table& table, Dwarf_Die* die, size_t parent, Dwarf_Files* files, Dwarf_Die* cu,
+                   Dwarf_Addr bias, bool copy_strings);
+  std::string_view function_name(const char* name, bool copy_strings);
+  // Where libdwfl found the DWARF of a module, for the prewarm threads to open again.
+  struct dwarf_file
+  {
+    std::string path;
+    std::string build_id; // if path is a separate debug file that may be in the debug cache
+    Dwarf_Addr bias = 0;
+    bool need_alt = false;
+  };
+
+  static int find_debuginfo(Dwfl_Module* mod, void** userdata, const char* modname, Dwarf_Addr base,
+                            const char* file_name, const char* debuglink_file, GElf_Word debuglink_crc,
+                            char** debuginfo_file_name);
+  int find_in_debug_dirs(const std::string& build_id, const char* debuglink_file,
+                         char** debuginfo_file_name);
+  void prewarm();
+  void prewarm_units(const dwarf_file& file, std::atomic<size_t>& next);
+  void prewarm_functions(Dwarf_Die* die, Dwarf_Die* cu, Dwarf_Addr bias, bool copy_strings);
+  void print_addrsym(lookup_cursor& cur, GElf_Addr addr, resolved_frame& frame);
+  void print_src(const char* src, int lineno, int linecol, Dwarf_Die* cu, resolved_frame& frame);
+  bool adjust_to_section(std::string_view name, uintmax_t* addr);
+  size_t names_memory_usage() const;
+
+  const options m_opts;
+  std::string m_build_id;
+  std::unique_ptr<elf_image> m_elf; // with symbols_only, unless the file needs libdwfl
+  std::string m_debuginfo_path;    // debug_dirs before the default path, for libdwfl
+  char* m_debuginfo_path_ptr = nullptr;
+  Dwfl_Callbacks m_callbacks{};    // must outlive m_dwfl
   Dwfl* m_dwfl = nullptr;
-  size_t demangle_buffer_len = 0;
-  char* demangle_buffer = nullptr;
+  std::mutex m_dwfl_lock; // libdw and libdwfl are not thread-safe, every call into them holds this
+  string_pool m_names;    // demangled and composed names referenced by resolved_frame
+
+  // Demangled DWARF function names by mangled name. Symbol table names are cached by their index.
+  mutable std::shared_mutex m_demangled_lock;
+  std::unordered_map<const char*, std::string_view> m_demangled;
+  frame_cache m_cache;
+  inline_cache m_inlines;
+  std::unordered_set<uint64_t> m_inline_cus; // CUs whose functions lookups built, under m_dwfl_lock
+  line_cache m_lines;
+  stage_recorder m_stats;
+
+  // Fixed after construction, so lookups can search them without locking.
+  std::vector<std::unique_ptr<module_entry>> m_modules; // in dwfl_getmodules order
+  std::vector<module_entry*> m_by_addr;                 // sorted by address
+
+  std::thread m_prewarm;                     // runs prewarm(), started last by the constructor
+  std::atomic<bool> m_prewarm_stop{ false }; // set by the destructor to cut the prewarm short
+  std::atomic<bool> m_prewarmed{ false };
+  std::mutex m_prewarm_lock;
+  std::condition_variable m_prewarm_done;    // signalled under m_prewarm_lock when m_prewarmed is set
 };